@@ -12,11 +12,29 @@ void print_usage(const char *prog) {
                                       "Index build:\n"
                                       "  --dim N            vector dimension (128)\n"
                                       "  --M N              HNSW max neighbors (16)\n"
-                                      "  --efc N            ef_construction (200)\n\n"
+                                      "  --efc N            ef_construction (200)\n"
+                                      "  --alpha A          neighbor selection alpha, > 1 keeps more long links (1.0)\n"
+                                      "  --keep-pruned      backfill pruned neighbor lists up to M\n\n"
                                       "Search:\n"
                                       "  --k N              KNN K (15)\n"
-                                      "  --efs N            ef_search (80)\n"
-                                      "  --queries N        queries per cluster (30)\n\n"
+                                      "  --efs N|auto       ef_search (80); auto = adaptive termination\n"
+                                      "  --patience N       auto efs: stale expansions before stopping, 0 = auto (0)\n"
+                                      "  --queries N        queries per cluster (30)\n"
+                                      "  --radius X         range search radius, 0 = auto (0)\n"
+                                      "  --max-results N    range search result cap (1000)\n"
+                                      "  --pages N          pages of k results for UT4 (5)\n"
+                                      "  --mq N             UT1: lockstep multi-query search, N queries per group (0 = off)\n"
+                                      "  --interleave W     UT1: coroutine-interleaved search, W in flight per thread (0 = off)\n\n"
+                                      "Sweep:\n"
+                                      "  --efs-list A,B,..  ef_search values (10,20,40,80,160,320)\n"
+                                      "  --k-list A,B,..    K values (--k)\n"
+                                      "  --out FILE         write results to FILE (.json or .csv)\n\n"
+                                      "Dataset files (UT1 / sweep, instead of synthetic clusters):\n"
+                                      "  --base FILE        base vectors (.fvecs / .bvecs), memory-mapped\n"
+                                      "  --query FILE       query vectors (.fvecs / .bvecs)\n"
+                                      "  --gt FILE          ground truth ids (.ivecs), exact scan if omitted\n"
+                                      "  --nq N             use the first N queries, 0 = all (0)\n"
+                                      "  --gt-cache DIR     cache computed ground truth in DIR (off)\n\n"
                                       "Clusters / UT:\n"
                                       "  --clusters N       number of clusters (6)\n"
                                       "  --pts N            points per cluster (200)\n"
@@ -24,10 +42,36 @@ void print_usage(const char *prog) {
                                       "  --center-dist X    center distance (8.0)\n"
                                       "  --seed N           RNG seed (42)\n\n"
                                       "Execution:\n"
-                                      "  --threads N        number of threads (1)\n\n"
+                                      "  --threads N        number of threads for build and data generation (1)\n"
+                                      "  --insert-batch N   parallel build in insert_batch() calls of N rows (0 = one call)\n"
+                                      "  --bulk-build       offline build: NN-Descent kNN graph per layer (HNSW::build)\n"
+                                      "  --vamana           UT1: compare with a flat Vamana graph (R = 2M, L = efc)\n"
+                                      "  --vamana-alpha A   Vamana RobustPrune alpha (1.2)\n"
+                                      "  --ivf P            UT1: compare with IVF-HNSW of P partitions (0 = off)\n"
+                                      "  --nprobe N         IVF-HNSW: probe 1, 2, 4, ... up to N partitions (8)\n"
+                                      "  --shards S         UT1: compare with 1, 2, 4, ... S hash-sharded indexes (0 = off)\n"
+                                      "  --stream P         UT1: streaming ingest via enqueue_insert() from P producers (0 = off)\n"
+                                      "  --wal DIR          UT1: durable ingest with a write-ahead log in DIR, then recovery (off)\n"
+                                      "  --snapshot-every N --wal: automatic snapshot every N log records (0 = off)\n"
+                                      "  --snapshot FILE    UT1: live snapshot to FILE during inserts and searches (off)\n"
+                                      "  --disk FILE        UT1: search vectors + level-0 links from FILE, PQ in RAM (off)\n"
+                                      "  --pq-m M           --disk: PQ bytes per vector (0 = dim / 4)\n"
+                                      "  --beam W           --disk: nodes read per beam round (4)\n\n"
                                       "Modes:\n"
                                       "  --ut1              HNSW vs exact KNN\n"
                                       "  --ut2              per-cluster precision UT\n"
+                                      "  --ut3              range search vs exact radius scan\n"
+                                      "  --ut4              paginated search iterator vs repeated search\n"
+                                      "  --sweep            build once, recall vs QPS over efs/k lists\n"
+                                      "  --gen PREFIX       write synthetic data to PREFIX_{base,query}.fvecs\n"
+                                      "  --serve ADDR       build the index, then serve queries on ADDR (unix:/path or tcp:PORT)\n"
+                                      "  --loadgen ADDR     open-loop load generator against a server at ADDR\n\n"
+                                      "Serving:\n"
+                                      "  --batch-max N      server: largest micro-batch (64)\n"
+                                      "  --batch-us N       server: micro-batch window in microseconds (200)\n"
+                                      "  --rate R           loadgen: target queries per second (1000)\n"
+                                      "  --duration S       loadgen: run time in seconds (5)\n"
+                                      "  --conns N          loadgen: connections (4)\n"
                                       "\n";
 }
 
@@ -41,6 +85,19 @@ static void parse_value(float &v, const char *s) {
 static void parse_value(double &v, const char *s) {
     v = std::stod(s);
 }
+static void parse_value(std::string &v, const char *s) {
+    v = s;
+}
+static void parse_value(std::vector<int> &v, const char *s) {
+    v.clear();
+    std::string str = s;
+    for (size_t pos = 0; pos <= str.size();) {
+        size_t comma = str.find(',', pos);
+        if (comma == std::string::npos) comma = str.size();
+        if (comma > pos) v.push_back(std::stoi(str.substr(pos, comma - pos)));
+        pos = comma + 1;
+    }
+}
 
 CmdArgs parse_args(int argc, char **argv) {
     CmdArgs a;
@@ -63,12 +120,49 @@ CmdArgs parse_args(int argc, char **argv) {
             next(a.M);
         else if (s == "--efc")
             next(a.efc);
+        else if (s == "--alpha")
+            next(a.alpha);
+        else if (s == "--keep-pruned")
+            a.keep_pruned = true;
         else if (s == "--k")
             next(a.k);
-        else if (s == "--efs")
-            next(a.efs);
+        else if (s == "--efs") {
+            if (i + 1 < argc && std::string(argv[i + 1]) == "auto") {
+                a.efs_auto = true;
+                ++i;
+            } else {
+                next(a.efs);
+            }
+        } else if (s == "--patience")
+            next(a.patience);
         else if (s == "--queries")
             next(a.queries);
+        else if (s == "--radius")
+            next(a.radius);
+        else if (s == "--max-results")
+            next(a.max_results);
+        else if (s == "--pages")
+            next(a.pages);
+        else if (s == "--mq")
+            next(a.mq);
+        else if (s == "--interleave")
+            next(a.interleave);
+        else if (s == "--efs-list")
+            next(a.efs_list);
+        else if (s == "--k-list")
+            next(a.k_list);
+        else if (s == "--out")
+            next(a.out);
+        else if (s == "--base")
+            next(a.base);
+        else if (s == "--query")
+            next(a.query);
+        else if (s == "--gt")
+            next(a.gt);
+        else if (s == "--nq")
+            next(a.nq);
+        else if (s == "--gt-cache")
+            next(a.gt_cache);
         else if (s == "--clusters")
             next(a.clusters);
         else if (s == "--pts")
@@ -81,10 +175,60 @@ CmdArgs parse_args(int argc, char **argv) {
             next(a.seed);
         else if (s == "--threads")
             next(a.threads);
+        else if (s == "--insert-batch")
+            next(a.insert_batch);
+        else if (s == "--bulk-build")
+            a.bulk_build = true;
+        else if (s == "--vamana")
+            a.vamana = true;
+        else if (s == "--vamana-alpha")
+            next(a.vamana_alpha);
+        else if (s == "--ivf")
+            next(a.ivf);
+        else if (s == "--nprobe")
+            next(a.nprobe);
+        else if (s == "--shards")
+            next(a.shards);
+        else if (s == "--stream")
+            next(a.stream);
+        else if (s == "--wal")
+            next(a.wal);
+        else if (s == "--snapshot-every")
+            next(a.snapshot_every);
+        else if (s == "--snapshot")
+            next(a.snapshot);
+        else if (s == "--disk")
+            next(a.disk);
+        else if (s == "--pq-m")
+            next(a.pq_m);
+        else if (s == "--beam")
+            next(a.beam);
         else if (s == "--ut1")
             a.ut1 = true;
         else if (s == "--ut2")
             a.ut2 = true;
+        else if (s == "--ut3")
+            a.ut3 = true;
+        else if (s == "--ut4")
+            a.ut4 = true;
+        else if (s == "--sweep")
+            a.sweep = true;
+        else if (s == "--gen")
+            next(a.gen);
+        else if (s == "--serve")
+            next(a.serve);
+        else if (s == "--loadgen")
+            next(a.loadgen);
+        else if (s == "--batch-max")
+            next(a.batch_max);
+        else if (s == "--batch-us")
+            next(a.batch_us);
+        else if (s == "--rate")
+            next(a.rate);
+        else if (s == "--duration")
+            next(a.duration);
+        else if (s == "--conns")
+            next(a.conns);
         else {
             std::cerr << "Unknown option: " << s << "\n";
             print_usage(argv[0]);
@@ -97,6 +241,47 @@ CmdArgs parse_args(int argc, char **argv) {
         std::cerr << "--threads must be > 0\n";
         std::exit(1);
     }
+    if (a.alpha < 1.0f || a.vamana_alpha < 1.0f) {
+        std::cerr << "--alpha and --vamana-alpha must be >= 1\n";
+        std::exit(1);
+    }
+    if (a.insert_batch < 0) {
+        std::cerr << "--insert-batch must be >= 0\n";
+        std::exit(1);
+    }
+    if (a.mq < 0 || a.mq > 32) {
+        std::cerr << "--mq must be in [0, 32]\n";
+        std::exit(1);
+    }
+    if (a.ivf < 0 || a.nprobe < 1) {
+        std::cerr << "--ivf must be >= 0 and --nprobe >= 1\n";
+        std::exit(1);
+    }
+    if (a.shards < 0 || a.stream < 0 || a.snapshot_every < 0) {
+        std::cerr << "--shards, --stream and --snapshot-every must be >= 0\n";
+        std::exit(1);
+    }
+    if (a.pq_m < 0 || a.beam < 1) {
+        std::cerr << "--pq-m must be >= 0 and --beam >= 1\n";
+        std::exit(1);
+    }
+    if (a.interleave < 0) {
+        std::cerr << "--interleave must be >= 0\n";
+        std::exit(1);
+    }
+    if (a.batch_max < 1 || a.batch_us < 0) {
+        std::cerr << "--batch-max must be >= 1 and --batch-us >= 0\n";
+        std::exit(1);
+    }
+    if (a.rate <= 0 || a.duration <= 0 || a.conns < 1) {
+        std::cerr << "--rate and --duration must be > 0 and --conns >= 1\n";
+        std::exit(1);
+    }
+    if (a.efs_list.empty()) {
+        std::cerr << "--efs-list must not be empty\n";
+        std::exit(1);
+    }
+    if (a.k_list.empty()) a.k_list = {a.k};
 
     return a;
 }
@@ -1,16 +1,40 @@
 #ifndef HNSW_CMD_ARGS_H
 #define HNSW_CMD_ARGS_H
 
+#include <string>
+#include <vector>
+
 struct CmdArgs {
     // --- index ---
     int dim = 128;
     int M = 16;
     int efc = 200;
+    float alpha = 1.0f;        // neighbor selection alpha (1 = HNSW heuristic)
+    bool keep_pruned = false;  // backfill pruned neighbor lists up to M
 
     // --- search ---
     int k = 15;
     int efs = 80;
+    bool efs_auto = false;   // --efs auto: adaptive termination, efs becomes the ceiling
+    int patience = 0;        // adaptive termination patience, 0 = auto from k
     int queries = 30;
+    float radius = 0.0f;     // range search radius (L2), 0 = auto from sigma/dim
+    int max_results = 1000;  // range search result cap
+    int pages = 5;           // pagination depth (pages of k results)
+    int mq = 0;              // UT1: also run search_multi in lockstep groups of this many, 0 = off
+    int interleave = 0;      // UT1: also run search_interleaved with this many searches in flight, 0 = off
+
+    // --- sweep ---
+    std::vector<int> efs_list = {10, 20, 40, 80, 160, 320};
+    std::vector<int> k_list;  // empty = {k}
+    std::string out;          // sweep output file, .json or .csv (empty = CSV on stdout)
+
+    // --- dataset files (TEXMEX .fvecs/.bvecs/.ivecs), replace the synthetic clusters ---
+    std::string base;   // base vectors
+    std::string query;  // query vectors
+    std::string gt;     // ground-truth neighbor ids (.ivecs), computed if empty
+    int nq = 0;         // use the first nq queries, 0 = all
+    std::string gt_cache;  // directory for cached ground truth (.ivecs), empty = off
 
     // --- clusters / UT ---
     int clusters = 6;
@@ -21,9 +45,36 @@ struct CmdArgs {
 
     // --- execution ---
     int threads = 1;   // number of worker threads
+    bool bulk_build = false;  // HNSW::build (NN-Descent) instead of inserts
+    int insert_batch = 0;       // parallel build: insert_batch() calls of this many rows, 0 = one call
+    bool vamana = false;        // UT1: also build a flat Vamana graph and compare
+    float vamana_alpha = 1.2f;  // Vamana second-pass RobustPrune alpha
+    int ivf = 0;                // UT1: also build an IVF-HNSW with this many partitions, 0 = off
+    int nprobe = 8;             // IVF-HNSW: largest number of partitions probed per query
+    int shards = 0;             // UT1: also build sharded indexes of 1, 2, 4, ... this many shards, 0 = off
+    int stream = 0;             // UT1: also ingest through enqueue_insert() from this many producers, 0 = off
+    std::string wal;            // UT1: also ingest into a DurableHNSW logged in this directory, then recover it
+    int snapshot_every = 0;     // DurableHNSW: WAL records between automatic snapshots, 0 = off
+    std::string snapshot;       // UT1: snapshot to this file while inserts and searches run
+    std::string disk;           // UT1: also lay the index out in this file and search it from there
+    int pq_m = 0;               // DiskHNSW: PQ bytes per vector, 0 = dim / 4
+    int beam = 4;               // DiskHNSW: nodes read per beam round
 
     bool ut1 = false;
     bool ut2 = false;
+    bool ut3 = false;
+    bool ut4 = false;
+    bool sweep = false;
+    std::string gen;  // write synthetic data to <gen>_base.fvecs / <gen>_query.fvecs
+
+    // --- serving ---
+    std::string serve;    // build the index, then serve queries on this address (unix:/path or tcp:PORT)
+    std::string loadgen;  // drive a server at this address with the query set
+    int batch_max = 64;   // server: largest micro-batch
+    int batch_us = 200;   // server: micro-batch window after the first queued query (us)
+    double rate = 1000;   // loadgen: target queries per second
+    double duration = 5;  // loadgen: seconds
+    int conns = 4;        // loadgen: connections
 };
 
 void print_usage(const char *prog);
@@ -0,0 +1,153 @@
+#ifndef HNSW_DATASET_IO_H
+#define HNSW_DATASET_IO_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ------------------------- TEXMEX vector files -------------------------
+// .fvecs / .bvecs / .ivecs (SIFT1M, GIST1M, Deep1B, ...): every record is an int32 dimension
+// followed by that many float32 / uint8 / int32 values. All records share one dimension.
+//
+// The file is mmap'd read-only and rows are decoded on demand into a caller-provided buffer,
+// so a base file is never copied into memory as a whole. If mmap is unavailable the file is
+// read into a private buffer instead.
+class VecFile {
+public:
+    enum class Type { FVECS, BVECS, IVECS };
+
+    explicit VecFile(const std::string &path) : path_(path), type_(type_from_path(path)) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Cannot open " + path);
+
+        struct stat st {};
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot stat " + path);
+        }
+        bytes_ = st.st_size;
+
+        if (bytes_ > 0) {
+            void *p = ::mmap(nullptr, bytes_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                map_ = p;
+                data_ = static_cast<const uint8_t *>(p);
+                ::madvise(p, bytes_, MADV_SEQUENTIAL);
+            } else {
+                fallback_.resize(bytes_);
+                std::ifstream f(path, std::ios::binary);
+                f.read(reinterpret_cast<char *>(fallback_.data()), bytes_);
+                if (!f) {
+                    ::close(fd);
+                    throw std::runtime_error("Cannot read " + path);
+                }
+                data_ = fallback_.data();
+            }
+        }
+        ::close(fd);
+
+        if (bytes_ < sizeof(int32_t)) fail("Empty vector file ");
+        int32_t d;
+        std::memcpy(&d, data_, sizeof(d));
+        if (d <= 0) fail("Bad dimension in ");
+        dim_ = d;
+        record_ = sizeof(int32_t) + size_t(dim_) * elem_size();
+        if (bytes_ % record_ != 0) fail("Truncated vector file ");
+        rows_ = bytes_ / record_;
+    }
+
+    ~VecFile() {
+        if (map_) ::munmap(map_, bytes_);
+    }
+
+    VecFile(const VecFile &) = delete;
+    VecFile &operator=(const VecFile &) = delete;
+
+    size_t size() const { return rows_; }
+    int dim() const { return dim_; }
+    Type type() const { return type_; }
+    const std::string &path() const { return path_; }
+
+    // Row i as floats (fvecs / bvecs); `out` is resized to dim() and reused across calls
+    void read(size_t i, std::vector<float> &out) const {
+        const uint8_t *p = row_data(i);
+        out.resize(dim_);
+        if (type_ == Type::FVECS) {
+            std::memcpy(out.data(), p, size_t(dim_) * sizeof(float));
+        } else if (type_ == Type::BVECS) {
+            for (int j = 0; j < dim_; j++) out[j] = p[j];
+        } else {
+            throw std::runtime_error("Not a float vector file: " + path_);
+        }
+    }
+
+    // Row i as floats without a copy for fvecs (a view into the mapping); bvecs are decoded into buf
+    std::span<const float> row(size_t i, std::vector<float> &buf) const {
+        if (type_ == Type::FVECS) return {reinterpret_cast<const float *>(row_data(i)), size_t(dim_)};
+        read(i, buf);
+        return buf;
+    }
+
+    // Row i as ints (ivecs, e.g. ground-truth neighbor ids)
+    void read(size_t i, std::vector<int> &out) const {
+        if (type_ != Type::IVECS) throw std::runtime_error("Not an ivecs file: " + path_);
+        out.resize(dim_);
+        std::memcpy(out.data(), row_data(i), size_t(dim_) * sizeof(int32_t));
+    }
+
+private:
+    std::string path_;
+    Type type_;
+    void *map_ = nullptr;
+    const uint8_t *data_ = nullptr;
+    std::vector<uint8_t> fallback_;
+    size_t bytes_ = 0;
+    size_t record_ = 0;
+    size_t rows_ = 0;
+    int dim_ = 0;
+
+    // The destructor does not run for a throwing constructor, so unmap here
+    [[noreturn]] void fail(const char *what) {
+        if (map_) ::munmap(map_, bytes_);
+        map_ = nullptr;
+        throw std::runtime_error(what + path_);
+    }
+
+    const uint8_t *row_data(size_t i) const { return data_ + i * record_ + sizeof(int32_t); }
+
+    size_t elem_size() const { return type_ == Type::BVECS ? 1 : 4; }
+
+    static Type type_from_path(const std::string &path) {
+        auto ends_with = [&](const char *ext) {
+            size_t n = std::strlen(ext);
+            return path.size() >= n && path.compare(path.size() - n, n, ext) == 0;
+        };
+        if (ends_with(".fvecs")) return Type::FVECS;
+        if (ends_with(".bvecs")) return Type::BVECS;
+        if (ends_with(".ivecs")) return Type::IVECS;
+        throw std::runtime_error("Unknown vector file type (expected .fvecs/.bvecs/.ivecs): " + path);
+    }
+};
+
+// Write rows as .ivecs (e.g. ground truth)
+inline void write_ivecs(const std::string &path, const std::vector<std::vector<int>> &rows) {
+    std::ofstream f(path, std::ios::binary);
+    if (!f) throw std::runtime_error("Cannot write " + path);
+    for (const auto &r: rows) {
+        int32_t d = r.size();
+        f.write(reinterpret_cast<const char *>(&d), sizeof(d));
+        f.write(reinterpret_cast<const char *>(r.data()), r.size() * sizeof(int32_t));
+    }
+    if (!f) throw std::runtime_error("Cannot write " + path);
+}
+
+#endif// HNSW_DATASET_IO_H
@@ -0,0 +1,406 @@
+#ifndef HNSW_DISK_HNSW_H
+#define HNSW_DISK_HNSW_H
+
+#include "hnsw.h"
+#include "interleave.h"
+#include "pq.h"
+#include "sector_io.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// ------------------------- SSD-resident HNSW -------------------------
+// For corpora whose vectors do not fit in RAM (DiskANN, Subramanya et al., NeurIPS'19): full
+// vectors and level-0 adjacency live in a sector-aligned file, while RAM holds only what
+// routing needs: m-byte PQ codes of every node, the upper layers, labels and levels.
+//
+// File layout: sector 0 is the header; from sector 1 on, one record per node (dim floats,
+// uint32 degree, R int32 neighbor ids, R = the largest level-0 degree), packed several to a
+// sector without straddling one, or spread over whole sectors if a record is larger. After the
+// records comes the in-memory part (PQ codebooks, codes, labels, upper layers), which open()
+// reads back, so a built file is searched again without the vectors ever being in RAM.
+//
+// Search descends the upper layers on PQ distances without any I/O, then runs a beam search
+// on level 0: each round takes the W closest unexpanded candidates, reads their sectors in
+// one batch (io_uring, or pread), scores the full vectors exactly and the new neighbors by PQ.
+// The answer is the expanded nodes re-ranked by their exact distances.
+class DiskHNSW {
+public:
+    struct Params {
+        int pq_m = 0;        // PQ bytes per vector, 0 = dim / 4
+        int threads = 1;     // PQ training and encoding
+        bool io_uring = true;// false: pread() only
+    };
+
+    struct IoStats {
+        size_t ios = 0;     // sectors read
+        size_t rounds = 0;  // beam rounds (dependent I/O batches)
+        size_t expanded = 0;// nodes read and re-ranked
+    };
+
+    // Writes `index` to `path` (graph must not change meanwhile) and keeps the in-memory part
+    DiskHNSW(const HNSW &index, const std::string &path, const Params &dp) : path_(path), dp_(dp) {
+        std::shared_lock lock(index.global_lock_);
+        const auto &nodes = index.nodes_;
+        n_ = nodes.size();
+        dim_ = index.dim_;
+        if (n_ < (size_t) ProductQuantizer::KSUB)
+            throw std::invalid_argument("DiskHNSW: index has " + std::to_string(n_) + " nodes; the PQ codebooks need at least " +
+                                        std::to_string(ProductQuantizer::KSUB) + " to train on");
+
+        R_ = 0;
+        for (auto &node: nodes) R_ = std::max(R_, node->neighbors[0].size());
+        record_ = dim_ * sizeof(float) + sizeof(uint32_t) + R_ * sizeof(int32_t);
+        per_sector_ = record_ <= SECTOR ? SECTOR / record_ : 0;
+        span_ = per_sector_ ? 1 : (record_ + SECTOR - 1) / SECTOR;
+
+        // In-memory part: PQ codes, labels, levels, upper-layer links
+        ThreadPool tp(std::max(1, dp.threads));
+        int m = dp.pq_m;
+        if (m <= 0)// largest divisor of dim up to dim / 4
+            for (m = std::max(1, dim_ / 4); dim_ % m != 0; m--) {}
+        pq_ = ProductQuantizer(dim_, m);
+        pq_.train(n_, [&](size_t i, std::vector<float> &) { return nodes[i]->vec; }, tp);
+        codes_.resize(n_ * pq_.m());
+        tp.parallel_for(0, n_, [&](size_t i, int) { pq_.encode(nodes[i]->vec, codes_.data() + i * pq_.m()); });
+
+        labels_.resize(n_);
+        upper_at_.assign(n_, -1);
+        for (size_t i = 0; i < n_; i++) {
+            const Node &node = *nodes[i];
+            labels_[i] = node.label;
+            if (node.level == 0) continue;
+            upper_at_[i] = (int) upper_.size();
+            upper_.emplace_back(node.neighbors.begin() + 1, node.neighbors.end());
+        }
+        entry_ = index.entry_point_.load();
+        max_level_ = index.max_level_.load();
+
+        write_file(nodes);
+    }
+
+    DiskHNSW(const DiskHNSW &) = delete;
+    DiskHNSW &operator=(const DiskHNSW &) = delete;
+
+    // A file written by the constructor above, for vectors of dimension `dim`: reads the header
+    // and the in-memory part, never the records. Throws std::runtime_error if the file is not
+    // such an image, is truncated, or does not match dim.
+    static std::unique_ptr<DiskHNSW> open(const std::string &path, int dim, bool io_uring = true) {
+        std::unique_ptr<DiskHNSW> d(new DiskHNSW());
+        d->path_ = path;
+        d->dp_.io_uring = io_uring;
+        d->read_file(dim);
+        return d;
+    }
+
+    // (exact squared L2, label) of the k nearest among the expanded nodes, closest first.
+    // L: level-0 candidate list size (as ef); W: nodes read per round.
+    std::vector<HNSW::Scored> search_scored(std::span<const float> query, int k, int L, int W = 4,
+                                            IoStats *stats = nullptr) const {
+        L = std::max(L, k);
+        W = std::max(1, W);
+        auto reader = acquire_reader();
+        IoStats st;
+
+        static thread_local std::vector<float> table;
+        table.resize((size_t) pq_.m() * ProductQuantizer::KSUB);
+        pq_.distance_table(query, table.data());
+        auto pq_dist = [&](int id) { return pq_.distance(table.data(), codes_.data() + (size_t) id * pq_.m()); };
+
+        // Upper layers: greedy on PQ distances, in memory
+        int ep = entry_;
+        float ep_d = pq_dist(ep);
+        for (int l = max_level_; l >= 1; l--) {
+            for (bool moved = true; moved;) {
+                moved = false;
+                const auto &links = upper_[upper_at_[ep]];
+                if ((size_t) l > links.size()) break;
+                for (int nb: links[l - 1]) {
+                    float d = pq_dist(nb);
+                    if (d < ep_d) ep_d = d, ep = nb, moved = true;
+                }
+            }
+        }
+
+        // Level 0: candidates sorted by PQ distance, at most L
+        struct Cand {
+            float d;
+            int id;
+            bool expanded;
+        };
+        std::vector<Cand> cand{{ep_d, ep, false}};
+        static thread_local VisitedSet visited;
+        visited.clear();
+        visited.insert(ep);
+
+        std::vector<HNSW::Scored> exact;
+        std::vector<int> batch;
+        std::vector<uint64_t> sectors;
+        static thread_local SectorBuffer buf;
+        while (true) {
+            batch.clear();
+            for (auto &c: cand) {
+                if (c.expanded) continue;
+                c.expanded = true;
+                batch.push_back(c.id);
+                if ((int) batch.size() == W) break;
+            }
+            if (batch.empty()) break;
+
+            // One read per distinct sector run
+            sectors.clear();
+            for (int id: batch)
+                for (size_t s = 0; s < span_; s++) sectors.push_back(sector_of(id) + s);
+            std::sort(sectors.begin(), sectors.end());
+            sectors.erase(std::unique(sectors.begin(), sectors.end()), sectors.end());
+            reader->read(sectors, buf);
+            st.ios += sectors.size();
+            st.rounds++;
+
+            for (int id: batch) {
+                size_t at = std::lower_bound(sectors.begin(), sectors.end(), sector_of(id)) - sectors.begin();
+                const char *rec = buf.sector(at) + offset_of(id);
+                exact.emplace_back(l2_distance(reinterpret_cast<const float *>(rec), query.data(), (size_t) dim_), id);
+
+                uint32_t deg;
+                std::memcpy(&deg, rec + dim_ * sizeof(float), sizeof(deg));
+                deg = std::min<uint32_t>(deg, (uint32_t) R_);
+                const char *nbrs = rec + dim_ * sizeof(float) + sizeof(uint32_t);
+                for (uint32_t j = 0; j < deg; j++) {
+                    int nb;
+                    std::memcpy(&nb, nbrs + j * sizeof(int32_t), sizeof(nb));
+                    if (nb < 0 || (size_t) nb >= n_ || !visited.insert(nb)) continue;// a damaged file must not index out of range
+                    float d = pq_dist(nb);
+                    if ((int) cand.size() >= L && d >= cand.back().d) continue;
+                    auto pos = std::upper_bound(cand.begin(), cand.end(), d, [](float v, const Cand &c) { return v < c.d; });
+                    cand.insert(pos, {d, nb, false});
+                    if ((int) cand.size() > L) cand.pop_back();
+                }
+            }
+            st.expanded += batch.size();
+        }
+        release_reader(std::move(reader));
+
+        size_t top = std::min<size_t>(k, exact.size());
+        std::partial_sort(exact.begin(), exact.begin() + top, exact.end());
+        exact.resize(top);
+        for (auto &e: exact) e.second = labels_[e.second];
+        if (stats) *stats = st;
+        return exact;
+    }
+
+    std::vector<int> search(std::span<const float> query, int k, int L, int W = 4, IoStats *stats = nullptr) const {
+        std::vector<int> res;
+        for (auto &[d, label]: search_scored(query, k, L, W, stats)) res.push_back(label);
+        return res;
+    }
+
+    size_t size() const { return n_; }
+    size_t file_bytes() const { return file_bytes_; }
+    size_t record_bytes() const { return record_; }
+    int pq_bytes() const { return pq_.m(); }
+
+    // RAM of the in-memory part: PQ codebooks and codes, labels, levels / upper-layer links
+    size_t memory_bytes() const {
+        size_t bytes = pq_.memory_bytes() + codes_.size() + labels_.size() * sizeof(int) +
+                       upper_at_.size() * sizeof(int);
+        for (auto &levels: upper_)
+            for (auto &l: levels) bytes += l.size() * sizeof(int) + sizeof(l);
+        return bytes;
+    }
+
+    // Readers opened from now on use io_uring (if the kernel allows) or pread(); not to be
+    // called while searches run
+    void use_io_uring(bool on) {
+        std::lock_guard lock(readers_mutex_);
+        dp_.io_uring = on;
+        readers_.clear();
+    }
+
+    // Backend the readers use (io_uring unless unavailable or disabled)
+    std::string backend() const {
+        auto r = acquire_reader();
+        std::string b = r->backend();
+        if (r->direct()) b += ", O_DIRECT";
+        release_reader(std::move(r));
+        return b;
+    }
+
+private:
+    static constexpr char MAGIC[8] = {'H', 'N', 'S', 'W', 'D', 'S', 'K', '1'};
+
+    // Sector 0 after MAGIC
+    struct Header {
+        uint64_t dim, R, n, record, per_sector, span;
+        int64_t entry, max_level;
+        uint64_t tail;// byte offset of the in-memory part
+    };
+
+    std::string path_;
+    Params dp_;
+    size_t n_ = 0;
+    int dim_ = 0;
+    size_t R_ = 0, record_ = 0, per_sector_ = 0, span_ = 1;
+    int entry_ = -1, max_level_ = -1;
+    size_t file_bytes_ = 0;
+
+    ProductQuantizer pq_;
+    std::vector<uint8_t> codes_;                // n x m
+    std::vector<int> labels_;
+    std::vector<int> upper_at_;                 // node -> upper_ row, -1 on level 0 only
+    std::vector<std::vector<std::vector<int>>> upper_;// levels 1..level of each upper node
+
+    // Readers hold an io_uring each, so they are pooled rather than shared
+    mutable std::mutex readers_mutex_;
+    mutable std::vector<std::unique_ptr<SectorReader>> readers_;
+
+    uint64_t sector_of(int id) const { return 1 + (per_sector_ ? id / per_sector_ : (uint64_t) id * span_); }
+    size_t offset_of(int id) const { return per_sector_ ? (id % per_sector_) * record_ : 0; }
+    size_t sectors_total() const { return per_sector_ ? (n_ + per_sector_ - 1) / per_sector_ : n_ * span_; }
+
+    DiskHNSW() = default;
+
+    std::unique_ptr<SectorReader> acquire_reader() const {
+        {
+            std::lock_guard lock(readers_mutex_);
+            if (!readers_.empty()) {
+                auto r = std::move(readers_.back());
+                readers_.pop_back();
+                return r;
+            }
+        }
+        return std::make_unique<SectorReader>(path_, dp_.io_uring);
+    }
+
+    void release_reader(std::unique_ptr<SectorReader> r) const {
+        std::lock_guard lock(readers_mutex_);
+        readers_.push_back(std::move(r));
+    }
+
+    void write_file(const std::vector<std::unique_ptr<Node>> &nodes) {
+        std::ofstream f(path_, std::ios::binary | std::ios::trunc);
+        if (!f) throw std::runtime_error("Cannot write " + path_);
+
+        std::vector<char> sector(SECTOR, 0);
+        auto put = [&](size_t at, const void *p, size_t n) { std::memcpy(sector.data() + at, p, n); };
+        const uint64_t tail = (1 + sectors_total()) * SECTOR;
+        Header h{(uint64_t) dim_, R_, n_, record_, per_sector_, span_, entry_, max_level_, tail};
+        put(0, MAGIC, sizeof(MAGIC));
+        put(sizeof(MAGIC), &h, sizeof(h));
+        f.write(sector.data(), SECTOR);
+
+        // Records in node order; a sector is flushed when the next record would not fit
+        std::vector<char> rec(span_ * SECTOR);
+        size_t used = 0;
+        std::fill(sector.begin(), sector.end(), 0);
+        for (size_t i = 0; i < n_; i++) {
+            const Node &node = *nodes[i];
+            std::fill(rec.begin(), rec.end(), 0);
+            std::memcpy(rec.data(), node.vec.data(), dim_ * sizeof(float));
+            uint32_t deg = (uint32_t) node.neighbors[0].size();
+            std::memcpy(rec.data() + dim_ * sizeof(float), &deg, sizeof(deg));
+            std::memcpy(rec.data() + dim_ * sizeof(float) + sizeof(deg), node.neighbors[0].data(), deg * sizeof(int32_t));
+            if (!per_sector_) {
+                f.write(rec.data(), rec.size());
+                continue;
+            }
+            if (used + record_ > SECTOR) {
+                f.write(sector.data(), SECTOR);
+                std::fill(sector.begin(), sector.end(), 0);
+                used = 0;
+            }
+            put(used, rec.data(), record_);
+            used += record_;
+        }
+        if (per_sector_ && used > 0) f.write(sector.data(), SECTOR);
+
+        // In-memory part: codebooks, codes, labels, then every node's level and upper links
+        pq_.save(f);
+        f.write(reinterpret_cast<const char *>(codes_.data()), codes_.size());
+        f.write(reinterpret_cast<const char *>(labels_.data()), labels_.size() * sizeof(int));
+        for (size_t i = 0; i < n_; i++) {
+            const int32_t levels = upper_at_[i] < 0 ? 0 : (int32_t) upper_[upper_at_[i]].size();
+            f.write(reinterpret_cast<const char *>(&levels), sizeof(levels));
+            for (int l = 0; l < levels; l++) {
+                const auto &links = upper_[upper_at_[i]][l];
+                const uint32_t cnt = (uint32_t) links.size();
+                f.write(reinterpret_cast<const char *>(&cnt), sizeof(cnt));
+                f.write(reinterpret_cast<const char *>(links.data()), cnt * sizeof(int));
+            }
+        }
+        file_bytes_ = (size_t) f.tellp();
+        if (!f.flush()) throw std::runtime_error("Cannot write " + path_);
+    }
+
+    void read_file(int dim) {
+        std::ifstream f(path_, std::ios::binary);
+        if (!f) throw std::runtime_error("Cannot open " + path_);
+        auto fail = [&](const std::string &why) { return std::runtime_error("DiskHNSW::open: " + path_ + ": " + why); };
+        auto get_n = [&](void *dst, size_t bytes) {
+            if (!f.read(static_cast<char *>(dst), (std::streamsize) bytes)) throw fail("truncated");
+        };
+
+        char magic[sizeof(MAGIC)];
+        Header h;
+        get_n(magic, sizeof(magic));
+        get_n(&h, sizeof(h));
+        if (!std::equal(magic, magic + sizeof(magic), MAGIC)) throw fail("not a DiskHNSW file");
+        if (h.dim != (uint64_t) dim) throw fail("dimension mismatch");
+        if (h.n == 0 || h.n > (uint64_t) std::numeric_limits<int>::max()) throw fail("bad node count");
+        if (h.record != dim * sizeof(float) + sizeof(uint32_t) + h.R * sizeof(int32_t)) throw fail("record size mismatch");
+        const uint64_t per_sector = h.record <= SECTOR ? SECTOR / h.record : 0;
+        const uint64_t span = per_sector ? 1 : (h.record + SECTOR - 1) / SECTOR;
+        if (h.per_sector != per_sector || h.span != span) throw fail("bad record layout");
+
+        dim_ = dim;
+        n_ = h.n;
+        R_ = h.R;
+        record_ = h.record;
+        per_sector_ = per_sector;
+        span_ = span;
+        entry_ = (int) h.entry;
+        max_level_ = (int) h.max_level;
+        if (h.tail != (1 + sectors_total()) * SECTOR) throw fail("bad record area size");
+        if (entry_ < 0 || (size_t) entry_ >= n_) throw fail("bad entry point");
+
+        f.seekg((std::streamoff) h.tail);
+        pq_.load(f);
+        if (pq_.dim() != dim_) throw fail("PQ dimension mismatch");
+        codes_.resize(n_ * pq_.m());
+        get_n(codes_.data(), codes_.size());
+        labels_.resize(n_);
+        get_n(labels_.data(), n_ * sizeof(int));
+        upper_at_.assign(n_, -1);
+        upper_.clear();
+        for (size_t i = 0; i < n_; i++) {
+            int32_t levels;
+            get_n(&levels, sizeof(levels));
+            if (levels < 0 || levels > max_level_) throw fail("bad node level");
+            if (levels == 0) continue;
+            upper_at_[i] = (int) upper_.size();
+            auto &node = upper_.emplace_back(levels);
+            for (auto &links: node) {
+                uint32_t cnt;
+                get_n(&cnt, sizeof(cnt));
+                links.resize(cnt);
+                get_n(links.data(), cnt * sizeof(int));
+                for (int id: links)
+                    if (id < 0 || (size_t) id >= n_) throw fail("link out of range");
+            }
+        }
+        if (max_level_ > 0 && (upper_at_[entry_] < 0 || (int) upper_[upper_at_[entry_]].size() != max_level_))
+            throw fail("entry point below max level");
+        file_bytes_ = (size_t) f.tellg();
+    }
+};
+
+#endif// HNSW_DISK_HNSW_H
@@ -9,12 +9,26 @@
 #include <arm_neon.h>
 #endif
 
-#include <vector>
+#include <cstddef>
+#include <span>
 
 // ------------------------- L2 Distance -------------------------
-inline float l2_distance_(const std::vector<float> &a, const std::vector<float> &b) {
+// Portable kernel: L2_LANES independent partial sums, so the compiler can vectorize without
+// reassociating float sums, added up lane by lane and then the tail. l2_distance_multi sums
+// in exactly this order, so both give bit-identical distances.
+constexpr size_t L2_LANES = 8;
+
+inline float l2_distance_(const float *a, const float *b, size_t n) {
+    float acc[L2_LANES] = {};
+    size_t i = 0;
+    for (; i + L2_LANES <= n; i += L2_LANES)
+        for (size_t l = 0; l < L2_LANES; l++) {
+            float d = a[i + l] - b[i + l];
+            acc[l] += d * d;
+        }
     float sum = 0.0f;
-    for (size_t i = 0; i < a.size(); i++) {
+    for (size_t l = 0; l < L2_LANES; l++) sum += acc[l];
+    for (; i < n; i++) {
         float d = a[i] - b[i];
         sum += d * d;
     }
@@ -22,20 +36,16 @@ inline float l2_distance_(const std::vector<float> &a, const std::vector<float>
 }
 
 
-inline float l2_distance(const std::vector<float> &a, const std::vector<float> &b) {
+inline float l2_distance(const float *pa, const float *pb, size_t n) {
 
 #if defined(__ARM_NEON) || defined(__ARM_NEON__)
 
-    size_t n = a.size();
-    const float *pa = a.data();
-    const float *pb = b.data();
-
     // Accumulator register initialized to [0, 0, 0, 0]
     float32x4_t sum_vec = vdupq_n_f32(0.0f);
 
     size_t i = 0;
     // Process 4 elements per iteration
-    for (; i <= n - 4; i += 4) {
+    for (; i + 4 <= n; i += 4) {
         float32x4_t va = vld1q_f32(pa + i);
         float32x4_t vb = vld1q_f32(pb + i);
 
@@ -59,8 +69,74 @@ inline float l2_distance(const std::vector<float> &a, const std::vector<float> &
 
 #else
     // Non-ARM fallback — use scalar implementation
-    return l2_distance_(a, b);
+    return l2_distance_(pa, pb, n);
+#endif
+}
+
+// ------------------------- Batched L2 Distance -------------------------
+// Squared L2 from one row x to nq rows qs[0..nq) (n floats each), into out[0..nq).
+// Queries are taken 4 at a time, so every chunk of x is loaded once per 4 queries instead
+// of once per query; the 4 accumulators stay in registers. Each distance is summed in the
+// order of l2_distance, so it equals l2_distance(x, qs[q], n) bit for bit.
+inline void l2_distance_multi(const float *x, const float *const *qs, size_t nq, size_t n, float *out) {
+    size_t q0 = 0;
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+    for (; q0 + 4 <= nq; q0 += 4) {
+        const float *a = qs[q0], *b = qs[q0 + 1], *c = qs[q0 + 2], *d = qs[q0 + 3];
+        float32x4_t sa = vdupq_n_f32(0.0f), sb = sa, sc = sa, sd = sa;
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            float32x4_t vx = vld1q_f32(x + i);
+            float32x4_t da = vsubq_f32(vld1q_f32(a + i), vx);
+            float32x4_t db = vsubq_f32(vld1q_f32(b + i), vx);
+            float32x4_t dc = vsubq_f32(vld1q_f32(c + i), vx);
+            float32x4_t dd = vsubq_f32(vld1q_f32(d + i), vx);
+            sa = vmlaq_f32(sa, da, da);
+            sb = vmlaq_f32(sb, db, db);
+            sc = vmlaq_f32(sc, dc, dc);
+            sd = vmlaq_f32(sd, dd, dd);
+        }
+        float t[4] = {vaddvq_f32(sa), vaddvq_f32(sb), vaddvq_f32(sc), vaddvq_f32(sd)};
+        for (; i < n; ++i)
+            for (int q = 0; q < 4; q++) {
+                float e = qs[q0 + q][i] - x[i];
+                t[q] += e * e;
+            }
+        for (int q = 0; q < 4; q++) out[q0 + q] = t[q];
+    }
+
+#else
+    // Portable: the lanes of l2_distance_, per query
+    constexpr size_t L = L2_LANES;
+    for (; q0 + 4 <= nq; q0 += 4) {
+        float acc[4][L] = {};
+        size_t i = 0;
+        for (; i + L <= n; i += L)
+            for (size_t q = 0; q < 4; q++)
+                for (size_t l = 0; l < L; l++) {
+                    float e = qs[q0 + q][i + l] - x[i + l];
+                    acc[q][l] += e * e;
+                }
+        for (size_t q = 0; q < 4; q++) {
+            float t = 0.0f;
+            for (size_t l = 0; l < L; l++) t += acc[q][l];
+            for (size_t j = i; j < n; j++) {
+                float e = qs[q0 + q][j] - x[j];
+                t += e * e;
+            }
+            out[q0 + q] = t;
+        }
+    }
 #endif
+
+    for (; q0 < nq; q0++) out[q0] = l2_distance(x, qs[q0], n);
+}
+
+// Any contiguous rows (std::vector, index storage, mapped files); b must hold a.size() floats
+inline float l2_distance(std::span<const float> a, std::span<const float> b) {
+    return l2_distance(a.data(), b.data(), a.size());
 }
 
 #endif// HNSW_DISTANCE_H
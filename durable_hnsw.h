@@ -0,0 +1,478 @@
+#ifndef HNSW_DURABLE_HNSW_H
+#define HNSW_DURABLE_HNSW_H
+
+#include "hnsw.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// ------------------------- Durable HNSW -------------------------
+// HNSW with a write-ahead log, so a crash loses no acknowledged write and no full save() is
+// needed per batch. Directory layout:
+//
+//   snapshot              last checkpoint: its LSN, the slot table and an HNSW::save() image
+//   wal.<first LSN>       append-only log segments; the current one is the last
+//
+// Every insert / update / remove appends one checksummed record and returns once it is on
+// disk. Records are group-committed: a flusher thread writes everything queued since its last
+// write with one write() + fdatasync(), so concurrent writers share the sync cost.
+// snapshot() (also every `snapshot_every` records) checkpoints and starts a new segment;
+// the segments it covers are deleted. Opening a directory recovers the last snapshot, then
+// replays the newer records: the slot table sequentially, the graph inserts in parallel.
+//
+// Deletes are tombstones. Graph nodes are labelled with a slot; the slot table maps slots to
+// user labels, and an update is a new slot for the label with the old one marked dead.
+// Searches skip dead slots. Dead nodes stay in the graph and keep routing queries.
+class DurableHNSW {
+public:
+    struct Params {
+        int M = 16;
+        int ef_construction = 200;
+        int threads = 1;           // recovery replay workers
+        size_t snapshot_every = 0; // WAL records between automatic snapshots, 0 = only snapshot()
+        bool fsync = true;         // false: write() only, survives a process crash but not power loss
+    };
+
+    struct RecoveryStats {
+        bool snapshot = false;
+        size_t snapshot_slots = 0;
+        size_t wal_records = 0;
+        size_t replayed_inserts = 0;// live slots inserted into the graph by the replay
+        double snapshot_sec = 0.0;
+        double replay_sec = 0.0;
+    };
+
+    // Opens the index in `dir` (created if missing) and recovers its state
+    DurableHNSW(const std::string &dir, int dim, const Params &dp)
+        : dir_(dir), dim_(dim), dp_(dp), index_(dim, dp.M, dp.ef_construction) {
+        std::filesystem::create_directories(dir_);
+        recover();
+        open_segment(next_lsn_ + 1);
+        flusher_ = std::thread([this]() { flush_loop(); });
+    }
+
+    ~DurableHNSW() {
+        {
+            std::lock_guard lock(log_mutex_);
+            stop_ = true;
+        }
+        log_cv_.notify_all();
+        flusher_.join();
+        ::close(wal_fd_);
+    }
+
+    DurableHNSW(const DurableHNSW &) = delete;
+    DurableHNSW &operator=(const DurableHNSW &) = delete;
+
+    // Thread-safe; each returns once its record is durable.
+    // insert() throws std::invalid_argument if the label is live.
+    // A write is applied to the slot table and graph before its record is committed, so
+    // searches can see it first (read-uncommitted). If the WAL write fails, the write throws
+    // std::runtime_error but stays in memory; it is lost on reopen. After such a failure every
+    // later write and snapshot() throws; reopen the directory to return to the durable state.
+    void insert(int label, std::span<const float> vec) {
+        check_dim(vec);
+        write(Op::INSERT, label, vec);
+    }
+
+    // Replaces the label's vector; false (and nothing logged) if the label is not live
+    bool update(int label, std::span<const float> vec) {
+        check_dim(vec);
+        return write(Op::UPDATE, label, vec);
+    }
+
+    bool remove(int label) { return write(Op::REMOVE, label, {}); }
+
+    // (squared L2, label) of the k nearest live labels. Over-fetches from the graph while
+    // tombstones crowd the live results out.
+    std::vector<HNSW::Scored> search_scored(std::span<const float> query, int k, int ef_search = -1) const {
+        std::vector<HNSW::Scored> res;
+        for (int fetch = k;; fetch *= 2) {
+            auto found = index_.search_scored(query, fetch, ef_search > 0 ? std::max(ef_search, fetch) : -1);
+            res.clear();
+            std::shared_lock meta(meta_mutex_);
+            for (auto &[d, slot]: found) {
+                if (!alive_[slot]) continue;
+                res.emplace_back(d, slot_label_[slot]);
+                if ((int) res.size() == k) return res;
+            }
+            if ((int) found.size() < fetch) return res;
+        }
+    }
+
+    std::vector<int> search(std::span<const float> query, int k, int ef_search = -1) const {
+        std::vector<int> res;
+        for (auto &[d, label]: search_scored(query, k, ef_search)) res.push_back(label);
+        return res;
+    }
+
+    // Checkpoint: waits for in-flight writes, writes the snapshot, starts a new WAL segment and
+    // deletes the old ones. Writers wait until it is done; searches continue.
+    void snapshot() {
+        std::unique_lock gate(gate_);
+        {
+            std::unique_lock lock(log_mutex_);
+            durable_cv_.wait(lock, [&]() { return durable_lsn_ == next_lsn_ || failed_; });
+            if (failed_) throw std::runtime_error("DurableHNSW: WAL write failed");
+        }
+        const uint64_t lsn = next_lsn_;
+        write_snapshot(lsn);
+
+        auto old = segments();
+        int fd = open_new_segment(lsn + 1);
+        {
+            std::lock_guard lock(log_mutex_);
+            std::swap(fd, wal_fd_);
+        }
+        ::close(fd);
+        for (auto &[first, path]: old) std::filesystem::remove(path);
+        since_snapshot_ = 0;
+        snapshots_++;
+    }
+
+    size_t size() const {
+        std::shared_lock meta(meta_mutex_);
+        return label_slot_.size();
+    }
+
+    const HNSW &graph() const { return index_; }
+    const RecoveryStats &recovery() const { return recovery_; }
+
+    // Records written and write + sync groups so far (this process)
+    size_t records() const {
+        std::lock_guard lock(log_mutex_);
+        return durable_lsn_ - first_lsn_;
+    }
+    size_t commits() const {
+        std::lock_guard lock(log_mutex_);
+        return commits_;
+    }
+    size_t snapshots() const { return snapshots_.load(); }
+
+private:
+    enum class Op : uint32_t { INSERT = 1, UPDATE = 2, REMOVE = 3 };
+
+    // Record: uint32 payload size, uint32 checksum of the payload, then the payload:
+    // uint64 lsn, uint32 op, int32 label, uint32 slot, dim floats (INSERT / UPDATE only)
+    static constexpr size_t RECORD_HEADER = 8, PAYLOAD_FIXED = 20;
+    static constexpr char SNAPSHOT_MAGIC[8] = {'H', 'N', 'S', 'W', 'S', 'N', 'P', '1'};
+
+    std::string dir_;
+    int dim_;
+    Params dp_;
+    HNSW index_;
+
+    // Slot table: slot -> label and liveness, label -> live slot
+    mutable std::shared_mutex meta_mutex_;
+    std::vector<int> slot_label_;
+    std::vector<uint8_t> alive_;
+    std::unordered_map<int, uint32_t> label_slot_;
+
+    std::shared_mutex gate_;// writers shared, snapshot() exclusive
+
+    // Log: records queued since the last group, handed to the flusher
+    mutable std::mutex log_mutex_;
+    std::condition_variable log_cv_, durable_cv_;
+    std::vector<char> buf_;
+    uint64_t next_lsn_ = 0;   // last assigned
+    uint64_t durable_lsn_ = 0;// every record up to this one is on disk
+    uint64_t first_lsn_ = 0;  // durable_lsn_ after recovery
+    size_t commits_ = 0;
+    bool stop_ = false, failed_ = false;
+    int wal_fd_ = -1;
+    std::thread flusher_;
+
+    std::atomic<size_t> since_snapshot_{0}, snapshots_{0};
+    std::atomic<bool> snapshotting_{false};
+    RecoveryStats recovery_;
+
+    static uint32_t checksum(const char *p, size_t n) {
+        uint32_t h = 2166136261u;// FNV-1a
+        for (size_t i = 0; i < n; i++) h = (h ^ (uint8_t) p[i]) * 16777619u;
+        return h;
+    }
+
+    void check_dim(std::span<const float> vec) const {
+        if (vec.size() != (size_t) dim_) throw std::invalid_argument("DurableHNSW: vector dimension mismatch");
+    }
+
+    // The slot table change of one record. The caller holds meta_mutex_ exclusively (or recovers
+    // alone). Returns the new slot (INSERT / UPDATE) or the removed one.
+    uint32_t apply(Op op, int label) {
+        auto it = label_slot_.find(label);
+        if (op != Op::INSERT) {
+            alive_[it->second] = 0;
+            if (op == Op::REMOVE) {
+                uint32_t slot = it->second;
+                label_slot_.erase(it);
+                return slot;
+            }
+        }
+        uint32_t slot = (uint32_t) slot_label_.size();
+        slot_label_.push_back(label);
+        alive_.push_back(1);
+        label_slot_[label] = slot;
+        return slot;
+    }
+
+    bool write(Op op, int label, std::span<const float> vec) {
+        uint64_t lsn;
+        {
+            std::shared_lock gate(gate_);
+            uint32_t slot;
+            {
+                std::unique_lock meta(meta_mutex_);
+                bool live = label_slot_.count(label) != 0;
+                if (op == Op::INSERT && live) throw std::invalid_argument("DurableHNSW: label already present");
+                if (op != Op::INSERT && !live) return false;
+                slot = apply(op, label);
+                lsn = append(op, label, slot, vec);
+            }
+            if (op != Op::REMOVE) index_.insert(vec, (int) slot);
+        }
+        wait_durable(lsn);
+
+        if (dp_.snapshot_every && ++since_snapshot_ >= dp_.snapshot_every && !snapshotting_.exchange(true)) {
+            struct Reset {
+                std::atomic<bool> &flag;
+                ~Reset() { flag = false; }
+            } reset{snapshotting_};// also when snapshot() throws
+            snapshot();
+        }
+        return true;
+    }
+
+    uint64_t append(Op op, int label, uint32_t slot, std::span<const float> vec) {
+        std::lock_guard lock(log_mutex_);
+        const uint64_t lsn = ++next_lsn_;
+        const uint32_t size = (uint32_t) (PAYLOAD_FIXED + vec.size_bytes());
+        const size_t at = buf_.size();
+        buf_.resize(at + RECORD_HEADER + size);
+        char *p = buf_.data() + at + RECORD_HEADER;
+        std::memcpy(p, &lsn, 8);
+        std::memcpy(p + 8, &op, 4);
+        std::memcpy(p + 12, &label, 4);
+        std::memcpy(p + 16, &slot, 4);
+        if (!vec.empty()) std::memcpy(p + PAYLOAD_FIXED, vec.data(), vec.size_bytes());
+        const uint32_t check = checksum(p, size);
+        std::memcpy(buf_.data() + at, &size, 4);
+        std::memcpy(buf_.data() + at + 4, &check, 4);
+        log_cv_.notify_one();
+        return lsn;
+    }
+
+    void wait_durable(uint64_t lsn) {
+        std::unique_lock lock(log_mutex_);
+        durable_cv_.wait(lock, [&]() { return durable_lsn_ >= lsn || failed_; });
+        if (failed_) throw std::runtime_error("DurableHNSW: WAL write failed");
+    }
+
+    // Group commit: whatever queued up while the previous group was being synced goes out with
+    // one write + fdatasync
+    void flush_loop() {
+        std::vector<char> group;
+        while (true) {
+            uint64_t upto;
+            int fd;
+            {
+                std::unique_lock lock(log_mutex_);
+                log_cv_.wait(lock, [&]() { return stop_ || !buf_.empty(); });
+                if (buf_.empty()) return;
+                group.swap(buf_);
+                upto = next_lsn_;
+                fd = wal_fd_;
+            }
+            bool ok = write_all(fd, group.data(), group.size()) && (!dp_.fsync || ::fdatasync(fd) == 0);
+            group.clear();
+            {
+                std::lock_guard lock(log_mutex_);
+                if (ok) durable_lsn_ = upto, commits_++;
+                else failed_ = true;
+            }
+            durable_cv_.notify_all();
+        }
+    }
+
+    static bool write_all(int fd, const char *p, size_t n) {
+        while (n > 0) {
+            ssize_t w = ::write(fd, p, n);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return false;
+            p += w, n -= w;
+        }
+        return true;
+    }
+
+    std::string segment_path(uint64_t first) const {
+        char name[32];
+        std::snprintf(name, sizeof(name), "wal.%020llu", (unsigned long long) first);
+        return dir_ + "/" + name;
+    }
+
+    // (first LSN, path) of every WAL segment, oldest first
+    std::vector<std::pair<uint64_t, std::string>> segments() const {
+        std::vector<std::pair<uint64_t, std::string>> res;
+        for (auto &e: std::filesystem::directory_iterator(dir_)) {
+            std::string name = e.path().filename().string();
+            if (name.rfind("wal.", 0) == 0) res.emplace_back(std::stoull(name.substr(4)), e.path().string());
+        }
+        std::sort(res.begin(), res.end());
+        return res;
+    }
+
+    int open_new_segment(uint64_t first) const {
+        std::string path = segment_path(first);
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0) throw std::runtime_error("Cannot open " + path);
+        sync_dir();
+        return fd;
+    }
+
+    void open_segment(uint64_t first) { wal_fd_ = open_new_segment(first); }
+
+    void sync_dir() const {
+        int fd = ::open(dir_.c_str(), O_RDONLY | O_DIRECTORY);
+        if (fd >= 0) {
+            ::fsync(fd);
+            ::close(fd);
+        }
+    }
+
+    // snapshot.tmp, synced, then renamed over snapshot
+    void write_snapshot(uint64_t lsn) const {
+        const std::string path = dir_ + "/snapshot", tmp = path + ".tmp";
+        {
+            std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+            if (!f) throw std::runtime_error("Cannot write " + tmp);
+            std::shared_lock meta(meta_mutex_);
+            const uint64_t slots = slot_label_.size();
+            f.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+            f.write(reinterpret_cast<const char *>(&lsn), sizeof(lsn));
+            f.write(reinterpret_cast<const char *>(&slots), sizeof(slots));
+            f.write(reinterpret_cast<const char *>(slot_label_.data()), slots * sizeof(int));
+            f.write(reinterpret_cast<const char *>(alive_.data()), slots);
+            index_.save(f);
+            if (!f.flush()) throw std::runtime_error("Cannot write " + tmp);
+        }
+        if (dp_.fsync) {
+            int fd = ::open(tmp.c_str(), O_RDONLY);
+            if (fd < 0 || ::fsync(fd) != 0) throw std::runtime_error("Cannot sync " + tmp);
+            ::close(fd);
+        }
+        std::filesystem::rename(tmp, path);
+        sync_dir();
+    }
+
+    // Snapshot, then the WAL records after it. A record that is torn or fails its checksum
+    // ends its segment (it was never acknowledged) and is cut off, so appends after it stay
+    // readable.
+    void recover() {
+        auto t0 = std::chrono::steady_clock::now();
+        uint64_t snap_lsn = 0;
+        const std::string snap = dir_ + "/snapshot";
+        if (std::filesystem::exists(snap)) {
+            std::ifstream f(snap, std::ios::binary);
+            char magic[sizeof(SNAPSHOT_MAGIC)];
+            uint64_t slots = 0;
+            f.read(magic, sizeof(magic));
+            f.read(reinterpret_cast<char *>(&snap_lsn), sizeof(snap_lsn));
+            f.read(reinterpret_cast<char *>(&slots), sizeof(slots));
+            if (!f || !std::equal(magic, magic + sizeof(magic), SNAPSHOT_MAGIC))
+                throw std::runtime_error("DurableHNSW: bad snapshot " + snap);
+            slot_label_.resize(slots);
+            alive_.resize(slots);
+            f.read(reinterpret_cast<char *>(slot_label_.data()), slots * sizeof(int));
+            f.read(reinterpret_cast<char *>(alive_.data()), slots);
+            if (!f) throw std::runtime_error("DurableHNSW: truncated snapshot " + snap);
+            for (uint32_t s = 0; s < slots; s++)
+                if (alive_[s]) label_slot_[slot_label_[s]] = s;
+            index_.load(f);
+            recovery_.snapshot = true;
+            recovery_.snapshot_slots = slots;
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        next_lsn_ = snap_lsn;
+
+        // Slot table in log order; the vectors of new slots are collected for the graph
+        std::vector<float> vecs;
+        std::vector<uint32_t> new_slots;
+        for (auto &[first, path]: segments()) {
+            std::ifstream f(path, std::ios::binary);
+            std::vector<char> data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+            size_t at = 0;
+            while (at + RECORD_HEADER <= data.size()) {
+                uint32_t size, check;
+                std::memcpy(&size, data.data() + at, 4);
+                std::memcpy(&check, data.data() + at + 4, 4);
+                const char *p = data.data() + at + RECORD_HEADER;
+                if (size < PAYLOAD_FIXED || at + RECORD_HEADER + size > data.size() || checksum(p, size) != check) break;
+                at += RECORD_HEADER + size;
+
+                uint64_t lsn;
+                Op op;
+                int label;
+                uint32_t slot;
+                std::memcpy(&lsn, p, 8);
+                std::memcpy(&op, p + 8, 4);
+                std::memcpy(&label, p + 12, 4);
+                std::memcpy(&slot, p + 16, 4);
+                if (lsn <= next_lsn_) continue;// covered by the snapshot
+                if (lsn != next_lsn_ + 1) throw std::runtime_error("DurableHNSW: WAL gap before LSN " + std::to_string(lsn));
+                next_lsn_ = lsn;
+                recovery_.wal_records++;
+
+                if ((op != Op::INSERT) != (label_slot_.count(label) != 0))
+                    throw std::runtime_error("DurableHNSW: WAL record " + std::to_string(lsn) + " does not apply");
+                if (apply(op, label) != slot)
+                    throw std::runtime_error("DurableHNSW: WAL slot mismatch at LSN " + std::to_string(lsn));
+                if (op != Op::REMOVE) {
+                    if (size != PAYLOAD_FIXED + dim_ * sizeof(float))
+                        throw std::runtime_error("DurableHNSW: WAL vector size mismatch");
+                    new_slots.push_back(slot);
+                    vecs.insert(vecs.end(), reinterpret_cast<const float *>(p + PAYLOAD_FIXED),
+                                reinterpret_cast<const float *>(p + size));
+                }
+            }
+            if (at < data.size()) std::filesystem::resize_file(path, at);
+        }
+
+        // Graph inserts of the slots still live, in parallel waves
+        std::vector<int> labels;
+        std::vector<size_t> rows;
+        for (size_t i = 0; i < new_slots.size(); i++) {
+            if (!alive_[new_slots[i]]) continue;
+            labels.push_back((int) new_slots[i]);
+            rows.push_back(i);
+        }
+        index_.insert_batch(rows.size(), [&](size_t i, std::vector<float> &) {
+            return std::span<const float>(vecs.data() + rows[i] * dim_, dim_);
+        }, labels, dp_.threads);
+        recovery_.replayed_inserts = rows.size();
+
+        auto t2 = std::chrono::steady_clock::now();
+        recovery_.snapshot_sec = std::chrono::duration<double>(t1 - t0).count();
+        recovery_.replay_sec = std::chrono::duration<double>(t2 - t1).count();
+        durable_lsn_ = first_lsn_ = next_lsn_;
+    }
+};
+
+#endif// HNSW_DURABLE_HNSW_H
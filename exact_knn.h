@@ -0,0 +1,139 @@
+#ifndef HNSW_EXACT_KNN_H
+#define HNSW_EXACT_KNN_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <span>
+#include <thread>
+#include <vector>
+
+// ------------------------- Blocked exact KNN (L2) -------------------------
+// Brute-force ground truth for large base sets. The base is cut into tiles of BASE_TILE rows
+// that threads claim one at a time; each tile is transposed (dim-major) so that a block of
+// QUERY_BLOCK queries is scored against the whole tile with a vectorizable
+// acc[q][x] += q[j] * x[j] loop, GEMM-style. Distances use ||q||^2 + ||x||^2 - 2 q.x,
+// accumulated in double: in float the cancellation swamps small distances between points
+// far from the origin (e.g. the tight synthetic clusters), while float products are exact
+// in double.
+// Every thread keeps its own bounded top-k heap per query; heaps are merged at the end.
+//
+// get_row(i, buf) returns base row i, like HNSW::insert_batch, so mapped files stream through
+// one tile buffer per thread. Returned ids are base row numbers, closest first.
+namespace exact_knn_detail {
+    constexpr size_t BASE_TILE = 128;// dim-major double tile: 128 KB at dim 128
+    constexpr size_t QUERY_BLOCK = 4;
+
+    using Heap = std::vector<std::pair<float, int>>;// max-heap on distance, at most k entries
+
+    inline void push_bounded(Heap &h, size_t k, float d, int id) {
+        if (h.size() < k) {
+            h.emplace_back(d, id);
+            std::push_heap(h.begin(), h.end());
+        } else if (d < h.front().first) {
+            std::pop_heap(h.begin(), h.end());
+            h.back() = {d, id};
+            std::push_heap(h.begin(), h.end());
+        }
+    }
+}// namespace exact_knn_detail
+
+template<class GetRow>
+std::vector<std::vector<int>> exact_knn_blocked(size_t n, int dim, GetRow &&get_row,
+                                                const std::vector<std::vector<float>> &queries,
+                                                int k, int num_threads = 0) {
+    using namespace exact_knn_detail;
+    const size_t nq = queries.size();
+    if (num_threads <= 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    // Queries packed row-major, padded to a whole number of blocks
+    size_t nq_pad = (nq + QUERY_BLOCK - 1) / QUERY_BLOCK * QUERY_BLOCK;
+    std::vector<double> qbuf(nq_pad * dim, 0.0), qnorm(nq_pad, 0.0);
+    for (size_t q = 0; q < nq; q++) {
+        for (int j = 0; j < dim; j++) {
+            qbuf[q * dim + j] = queries[q][j];
+            qnorm[q] += qbuf[q * dim + j] * qbuf[q * dim + j];
+        }
+    }
+
+    size_t tiles = (n + BASE_TILE - 1) / BASE_TILE;
+    std::vector<std::vector<Heap>> heaps(num_threads, std::vector<Heap>(nq));
+    std::atomic<size_t> next_tile(0);
+
+    auto worker = [&](int t) {
+        std::vector<Heap> &my = heaps[t];
+        std::vector<double> xt(dim * BASE_TILE), xnorm(BASE_TILE), acc(QUERY_BLOCK * BASE_TILE);
+        std::vector<float> buf;
+
+        while (true) {
+            size_t tile = next_tile.fetch_add(1);
+            if (tile >= tiles) break;
+            size_t b0 = tile * BASE_TILE, bn = std::min(BASE_TILE, n - b0);
+
+            // Transpose the tile to dim-major and take the row norms
+            for (size_t b = 0; b < bn; b++) {
+                std::span<const float> row = get_row(b0 + b, buf);
+                double s = 0.0;
+                for (int j = 0; j < dim; j++) {
+                    xt[j * BASE_TILE + b] = row[j];
+                    s += double(row[j]) * row[j];
+                }
+                xnorm[b] = s;
+            }
+
+            for (size_t q0 = 0; q0 < nq; q0 += QUERY_BLOCK) {
+                std::fill(acc.begin(), acc.end(), 0.0);
+                for (int j = 0; j < dim; j++) {
+                    const double *xj = &xt[j * BASE_TILE];
+                    for (size_t r = 0; r < QUERY_BLOCK; r++) {
+                        double qv = qbuf[(q0 + r) * dim + j];
+                        double *a = &acc[r * BASE_TILE];
+                        for (size_t b = 0; b < bn; b++) a[b] += qv * xj[b];
+                    }
+                }
+                for (size_t r = 0; r < QUERY_BLOCK && q0 + r < nq; r++) {
+                    Heap &h = my[q0 + r];
+                    const double *a = &acc[r * BASE_TILE];
+                    for (size_t b = 0; b < bn; b++) {
+                        float d = (float) std::max(0.0, qnorm[q0 + r] + xnorm[b] - 2.0 * a[b]);
+                        push_bounded(h, k, d, (int) (b0 + b));
+                    }
+                }
+            }
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < num_threads; t++) workers.emplace_back(worker, t);
+    for (auto &w: workers) w.join();
+
+    // Merge the per-thread heaps
+    std::vector<std::vector<int>> res(nq);
+    for (size_t q = 0; q < nq; q++) {
+        Heap all;
+        for (int t = 0; t < num_threads; t++) all.insert(all.end(), heaps[t][q].begin(), heaps[t][q].end());
+        size_t kk = std::min<size_t>(k, all.size());
+        std::partial_sort(all.begin(), all.begin() + kk, all.end());
+        res[q].reserve(kk);
+        for (size_t i = 0; i < kk; i++) res[q].push_back(all[i].second);
+    }
+    return res;
+}
+
+// ------------------------- Dataset fingerprint -------------------------
+// FNV-1a over every row's bytes; keys the ground-truth cache
+template<class GetRow>
+uint64_t fingerprint_rows(size_t n, GetRow &&get_row, uint64_t h = 14695981039346656037ull) {
+    std::vector<float> buf;
+    for (size_t i = 0; i < n; i++) {
+        std::span<const float> row = get_row(i, buf);
+        const auto *p = reinterpret_cast<const unsigned char *>(row.data());
+        for (size_t b = 0; b < row.size() * sizeof(float); b++) {
+            h ^= p[b];
+            h *= 1099511628211ull;
+        }
+    }
+    return h;
+}
+
+#endif// HNSW_EXACT_KNN_H
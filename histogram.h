@@ -0,0 +1,91 @@
+#ifndef HNSW_HISTOGRAM_H
+#define HNSW_HISTOGRAM_H
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+// ------------------------- Latency histogram -------------------------
+// HDR-style log-linear buckets over nanoseconds: values below 2^SUB_BITS are exact, above
+// that every power of two is split into 2^SUB_BITS linear sub-buckets (~3% relative error).
+// Recording is O(1) with no allocation, so it can sit inside timed loops.
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 5;
+    static constexpr uint64_t SUB_COUNT = uint64_t(1) << SUB_BITS;
+
+    LatencyHistogram() : buckets_((64 - SUB_BITS + 1) * SUB_COUNT, 0) {}
+
+    void record(std::chrono::nanoseconds d) {
+        record_ns(d.count() > 0 ? (uint64_t) d.count() : 0);
+    }
+
+    void record_ns(uint64_t v) {
+        buckets_[bucket_of(v)]++;
+        count_++;
+        sum_ += v;
+        max_ = std::max(max_, v);
+    }
+
+    void merge(const LatencyHistogram &o) {
+        for (size_t i = 0; i < buckets_.size(); i++) buckets_[i] += o.buckets_[i];
+        count_ += o.count_;
+        sum_ += o.sum_;
+        max_ = std::max(max_, o.max_);
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t max_ns() const { return max_; }
+    double mean_ns() const { return count_ ? double(sum_) / count_ : 0.0; }
+
+    // Highest value equivalent to the q-th quantile (q in [0, 1]), capped at the true max
+    uint64_t percentile_ns(double q) const {
+        if (count_ == 0) return 0;
+        uint64_t rank = std::max<uint64_t>(1, (uint64_t) std::ceil(q * count_));
+        uint64_t seen = 0;
+        for (size_t b = 0; b < buckets_.size(); b++) {
+            seen += buckets_[b];
+            if (seen >= rank) return std::min(max_, upper_bound_of(b));
+        }
+        return max_;
+    }
+
+    // One line: count, mean, p50/p90/p99/p99.9 and max in microseconds
+    void print(const char *label, std::ostream &os = std::cout) const {
+        auto us = [](double ns) { return ns / 1000.0; };
+        os << "[LATENCY] " << label << " (us, n=" << count_ << "): " << std::fixed << std::setprecision(1)
+           << "mean " << us(mean_ns())
+           << "  p50 " << us(percentile_ns(0.50))
+           << "  p90 " << us(percentile_ns(0.90))
+           << "  p99 " << us(percentile_ns(0.99))
+           << "  p99.9 " << us(percentile_ns(0.999))
+           << "  max " << us(max_ns()) << "\n"
+           << std::defaultfloat << std::setprecision(6);
+    }
+
+private:
+    std::vector<uint64_t> buckets_;
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t max_ = 0;
+
+    static size_t bucket_of(uint64_t v) {
+        if (v < SUB_COUNT) return v;
+        int msb = 63 - std::countl_zero(v);
+        int shift = msb - SUB_BITS;
+        return (size_t(shift + 1) << SUB_BITS) + ((v >> shift) & (SUB_COUNT - 1));
+    }
+
+    static uint64_t upper_bound_of(size_t b) {
+        uint64_t group = b >> SUB_BITS, sub = b & (SUB_COUNT - 1);
+        if (group == 0) return sub;
+        return ((SUB_COUNT + sub + 1) << (group - 1)) - 1;
+    }
+};
+
+#endif// HNSW_HISTOGRAM_H
@@ -2,73 +2,437 @@
 #define HNSW_HNSW_H
 
 #include "distance.h"
+#include "interleave.h"
+#include "thread_pool.h"
 #include <algorithm>
 #include <atomic>
+#include <bit>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <ostream>
 #include <queue>
 #include <random>
 #include <shared_mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
 #include <thread>
 #include <vector>
 
+// Per-query search statistics. Only filled when built with HNSW_SEARCH_STATS
+// (cmake -DHNSW_SEARCH_STATS=ON); otherwise the hooks compile away entirely.
+#ifdef HNSW_SEARCH_STATS
+#define HNSW_STAT(...) __VA_ARGS__
+#else
+#define HNSW_STAT(...)
+#endif
+
+struct SearchStats {
+    std::vector<size_t> dist_evals;// per layer, index = level; never empty
+    size_t nodes_expanded = 0;     // candidates popped and whose neighbors were scanned
+    size_t heap_pushes = 0;        // pushes into the candidate and result heaps
+    size_t visited_resets = 0;     // full clears / regrowth of the thread-local visited list
+    double wall_time = 0.0;        // seconds, whole search() call
+
+    size_t total_dist_evals() const {
+        size_t n = 0;
+        for (size_t d: dist_evals) n += d;
+        return n;
+    }
+};
+
+// A node's links with their cached distances, as HNSW::save() captures them
+struct LinkImage {
+    std::vector<std::vector<int>> neighbors;
+    std::vector<std::vector<float>> dists;
+};
+
 struct Node {
-    std::vector<float> vec;
+    std::span<const float> vec;// dim floats in the index's vector store
     std::vector<std::vector<int>> neighbors;
+    std::vector<std::vector<float>> dists;// squared L2 to each neighbor, same order; see HNSW::set_links
     int level;
-    mutable std::shared_mutex node_mutex;// Protects neighbors list
+    int label;// external id returned by searches
+    mutable std::shared_mutex node_mutex;// Protects neighbors, dists and snap_before
+    std::atomic<bool> linked{true};// false while insert() is still linking it in
+    mutable std::atomic<uint32_t> snap_epoch{0};// HNSW::save() epoch this node's links were captured for
+    mutable std::unique_ptr<LinkImage> snap_before;// links as of that save()'s cut; see HNSW::preserve_links
 
-    Node(const std::vector<float> &v, int lvl)
-        : vec(v), neighbors(lvl + 1), level(lvl) {}
+    Node(std::span<const float> v, int lvl, int lbl)
+        : vec(v), neighbors(lvl + 1), dists(lvl + 1), level(lvl), label(lbl) {}
 };
 
 class HNSW {
 public:
+    using Scored = std::pair<float, int>;// (squared L2, node id)
+
     HNSW(int dim, int M = 16, int ef_construction = 200)
         : dim_(dim), M_(M), ef_(ef_construction), entry_point_(-1), max_level_(-1) {
         nodes_.reserve(100000);
     }
 
-    // Parallel batch insertion
+    // Parallel batch insertion; row i gets label size() + i (size() at the start of the call)
     void insert_batch(const std::vector<std::vector<float>> &data, int num_threads = 8) {
-        if (data.empty()) return;
+        insert_batch(data.size(), [&](size_t i, std::vector<float> &) -> const std::vector<float> & {
+            return data[i];
+        }, num_threads);
+    }
 
-        // Phase 1: Sequential Core (Stabilizes the top of the graph)
-        size_t core_size = std::min(data.size(), (size_t) 500);
-        for (size_t i = 0; i < core_size; ++i) {
-            insert_internal(data[i]);
-        }
+    // Parallel batch insertion of a row-major n x dim() matrix, copied straight into index storage
+    void insert_batch(std::span<const float> rows, int num_threads = 8) {
+        insert_batch(matrix_rows(rows), [&](size_t i, std::vector<float> &) {
+            return rows.subspan(i * dim_, dim_);
+        }, num_threads);
+    }
 
-        if (core_size >= data.size()) return;
+    // Parallel batch insertion from any row source (e.g. a memory-mapped file).
+    // get_row(i, buf) returns row i as anything convertible to std::span<const float>: a view
+    // of existing storage, or `buf` (a per-thread scratch vector) filled in place.
+    template<class GetRow>
+    void insert_batch(size_t n, GetRow &&get_row, int num_threads = 8) {
+        const size_t label0 = size();
+        insert_rows(n, get_row, [&](size_t i) { return (int) (label0 + i); }, num_threads);
+    }
 
-        // Phase 2: Parallel Workers
-        std::vector<std::thread> workers;
-        std::atomic<size_t> next_idx(core_size);
-        for (int i = 0; i < num_threads; ++i) {
-            workers.emplace_back([&]() {
-                while (true) {
-                    size_t idx = next_idx.fetch_add(1);
-                    if (idx >= data.size()) break;
-                    insert_internal(data[idx]);
-                }
-            });
+    // Same with explicit labels: row i gets labels[i]
+    template<class GetRow>
+    void insert_batch(size_t n, GetRow &&get_row, std::span<const int> labels, int num_threads = 8) {
+        if (labels.size() != n) throw std::invalid_argument("HNSW::insert_batch: one label per row");
+        insert_rows(n, get_row, [&](size_t i) { return labels[i]; }, num_threads);
+    }
+
+    // Neighbor selection for inserts and bulk builds: alpha > 1 keeps more long-range links
+    // (RobustPrune); keep_pruned backfills lists the heuristic leaves below M.
+    void set_prune(float alpha, bool keep_pruned) {
+        alpha_ = alpha;
+        keep_pruned_ = keep_pruned;
+    }
+
+    // Offline bulk build into an empty index; row i gets label i. Instead of inserting one
+    // row at a time, every layer is built at once: an approximate kNN graph by parallel
+    // NN-Descent, diversified with the insert heuristic, plus the reverse links.
+    void build(const std::vector<std::vector<float>> &data, int num_threads = 8) {
+        build(data.size(), [&](size_t i, std::vector<float> &) -> const std::vector<float> & {
+            return data[i];
+        }, num_threads);
+    }
+
+    void build(std::span<const float> rows, int num_threads = 8) {
+        build(matrix_rows(rows), [&](size_t i, std::vector<float> &) {
+            return rows.subspan(i * dim_, dim_);
+        }, num_threads);
+    }
+
+    template<class GetRow>
+    void build(size_t n, GetRow &&get_row, int num_threads = 8) {
+        if (size() != 0) throw std::logic_error("HNSW::build requires an empty index");
+        nodes_.reserve(n);
+        std::vector<float> buf;
+        for (size_t i = 0; i < n; i++)
+            nodes_.push_back(std::make_unique<Node>(store_vector(get_row(i, buf)), random_level(), (int) i));
+        build_layers(pool(num_threads));
+    }
+
+    // Flat Vamana graph (DiskANN, Subramanya et al., NeurIPS'19): every node on layer 0 with up
+    // to R links, entered at the medoid. Searched by the same search() / layer-0 beam.
+    struct VamanaParams {
+        int R = 32;         // max out-degree
+        int L = 100;        // build beam width
+        float alpha = 1.2f; // second-pass RobustPrune slack (on L2 distance), >= 1
+    };
+
+    // Offline build into an empty index; row i gets label i
+    void build_vamana(const std::vector<std::vector<float>> &data, const VamanaParams &vp, int num_threads = 8) {
+        build_vamana(data.size(), [&](size_t i, std::vector<float> &) -> const std::vector<float> & {
+            return data[i];
+        }, vp, num_threads);
+    }
+
+    template<class GetRow>
+    void build_vamana(size_t n, GetRow &&get_row, const VamanaParams &vp, int num_threads = 8) {
+        if (size() != 0) throw std::logic_error("HNSW::build_vamana requires an empty index");
+        nodes_.reserve(n);
+        std::vector<float> buf;
+        for (size_t i = 0; i < n; i++)
+            nodes_.push_back(std::make_unique<Node>(store_vector(get_row(i, buf)), 0, (int) i));
+        build_flat(vp, pool(num_threads));
+    }
+
+    // Total directed links over all layers (graph memory is ~4 bytes per link)
+    size_t link_count() const {
+        std::shared_lock lock(global_lock_);
+        size_t links = 0;
+        for (auto &node: nodes_) {
+            std::shared_lock nb_read(node->node_mutex);
+            for (auto &layer: node->neighbors) links += layer.size();
         }
-        for (auto &t: workers) t.join();
+        return links;
+    }
+
+    // Share a pool between indexes (or with the caller). Once set, batch calls ignore
+    // num_threads and run on this pool; otherwise the index owns one pool and runs each call
+    // on num_threads of its workers.
+    void set_thread_pool(std::shared_ptr<ThreadPool> tp) {
+        std::lock_guard lock(pool_mutex_);
+        pool_ = std::move(tp);
+        pool_shared_ = (pool_ != nullptr);
+    }
+
+    size_t size() const {
+        std::shared_lock lock(global_lock_);
+        return nodes_.size();
+    }
+
+    int dim() const { return dim_; }
+
+    // label < 0: use the insertion order as the label. vec (dim() floats) is copied into the
+    // index's own storage; a std::vector, a row of a matrix or of a mapped file all work.
+    void insert(std::span<const float> vec, int label = -1) {
+        insert_internal(vec, label);
     }
 
-    void insert(const std::vector<float> &vec) {
-        insert_internal(vec);
+    // patience > 0 enables adaptive termination: ef_search becomes a ceiling and the beam
+    // stops once the best k have not improved for `patience` consecutive expansions.
+    // stats is filled only in HNSW_SEARCH_STATS builds.
+    // Searches return labels, closest first.
+    std::vector<int> search(std::span<const float> query, int k, int ef_search = -1, int patience = 0,
+                            SearchStats *stats = nullptr) const;
+
+    // search() with distances: (squared L2, label) pairs, closest first, e.g. to merge the
+    // results of several indexes
+    std::vector<Scored> search_scored(std::span<const float> query, int k, int ef_search = -1, int patience = 0,
+                                      SearchStats *stats = nullptr) const;
+
+    // search() for every query, spread over the thread pool; results in query order
+    std::vector<std::vector<int>> search_batch(const std::vector<std::vector<float>> &queries, int k,
+                                               int ef_search = -1, int num_threads = 8) const {
+        std::vector<std::vector<int>> res(queries.size());
+        pool(num_threads).parallel_for(0, queries.size(), [&](size_t q, int) {
+            res[q] = search(queries[q], k, ef_search);
+        });
+        return res;
+    }
+
+    // Same for a row-major nq x dim() matrix of queries
+    std::vector<std::vector<int>> search_batch(std::span<const float> queries, int k, int ef_search = -1,
+                                               int num_threads = 8) const {
+        std::vector<std::vector<int>> res(matrix_rows(queries));
+        pool(num_threads).parallel_for(0, res.size(), [&](size_t q, int) {
+            res[q] = search(queries.subspan(q * dim_, dim_), k, ef_search);
+        });
+        return res;
+    }
+
+    // Lockstep search of a row-major nq x dim() query matrix, `group` queries (at most
+    // MULTI_MAX) walking the graph together. A node that several queries of the group expand
+    // in the same step is read once and its neighbors are scored against all of them with
+    // one batched kernel call, so the shared descent from the entry point is paid once per
+    // group. l2_distance_multi gives the same bits as l2_distance, so each query still follows
+    // exactly the beam of search(). Groups run on the pool.
+    std::vector<std::vector<int>> search_multi(std::span<const float> queries, int k, int ef_search = -1,
+                                               int group = 8, int num_threads = 8) const {
+        const size_t nq = matrix_rows(queries);
+        const size_t g = std::clamp(group, 1, MULTI_MAX);
+        const int ef = (ef_search > 0) ? ef_search : std::max(ef_, k);
+        std::vector<std::vector<int>> res(nq);
+        pool(num_threads).parallel_for(0, (nq + g - 1) / g, [&](size_t gi, int) {
+            const float *qs[MULTI_MAX];
+            const size_t q0 = gi * g, m = std::min(g, nq - q0);
+            for (size_t i = 0; i < m; i++) qs[i] = queries.data() + (q0 + i) * dim_;
+            search_group(qs, (int) m, k, ef, &res[q0]);
+        });
+        return res;
     }
 
-    std::vector<int> search(const std::vector<float> &query, int k, int ef_search = -1) const;
+    static constexpr int MULTI_MAX = 32;// queries per search_multi group (one visited bit each)
+
+    // search() for a row-major nq x dim() query matrix with `width` searches in flight per
+    // thread (interleave.h). Before every step a search prefetches what that step reads (the
+    // adjacency list of the node it expands, then the Node records and vectors of its unvisited
+    // neighbors) and yields to the next search, so the DRAM misses of all in-flight searches
+    // overlap. Worth it once the index is much larger than the last-level cache.
+    // Results are those of search().
+    std::vector<std::vector<int>> search_interleaved(std::span<const float> queries, int k, int ef_search = -1,
+                                                     int width = 16, int num_threads = 8) const {
+        const size_t nq = matrix_rows(queries);
+        const int ef = (ef_search > 0) ? ef_search : std::max(ef_, k);
+        width = std::max(1, width);
+        const size_t block = (size_t) width * INTERLEAVE_BLOCK;
+        std::vector<std::vector<int>> res(nq);
+        pool(num_threads).parallel_for(0, (nq + block - 1) / block, [&](size_t b, int) {
+            std::shared_lock lock(global_lock_);
+            size_t next = b * block;
+            const size_t end = std::min(nq, next + block);
+            std::vector<CoTask> tasks;
+            for (int i = 0; i < width; i++) tasks.push_back(search_walker(queries, next, end, k, ef, res));
+            run_interleaved(tasks);
+        });
+        return res;
+    }
+
+    // Running count of distance evaluations in layer searches (queries and inserts) and neighbor
+    // pruning on the calling thread.
+    static size_t thread_distance_evals() { return tl_dist_evals; }
+
+    // Distance evaluations spent by insert() / insert_batch() so far, over all threads
+    size_t insert_distance_evals() const { return insert_dist_evals_.load(std::memory_order_relaxed); }
+
+    // Binary image of the graph: header, all vectors in node order, then every node's level,
+    // label and per-level links with their cached distances. insert() / insert_batch() and
+    // searches keep running meanwhile (see preserve_links). The image is the graph at the
+    // moment save() starts, cut below the first node an insert was still linking in: the few
+    // newest nodes may be missing, and links to them are dropped. Not concurrent with the
+    // offline builds.
+    void save(std::ostream &os) const;
+
+    // save() to a file; returns the bytes written
+    size_t snapshot(const std::string &path) const;
+
+    // Read a save() image into an empty index of the same dim(); M and ef_construction are
+    // taken from the image. Throws std::runtime_error on a malformed or truncated image.
+    void load(std::istream &is);
+
+    // All points within L2 distance `radius` of the query (closest first), at most max_results.
+    // Throws std::invalid_argument if radius < 0.
+    // ef_search is the slack kept beyond the radius while the frontier grows.
+    std::vector<int> range_search(std::span<const float> query, float radius,
+                                  int max_results, int ef_search = -1) const;
+
+    // Resumable layer-0 search: keeps the frontier and visited set between next() calls,
+    // so each page only pays for the extra hops. Must not outlive the index.
+    class SearchIterator {
+    public:
+        // Next n results (closest first); fewer once the reachable graph is exhausted.
+        std::vector<int> next(int n);
+        size_t returned() const { return returned_; }
+
+    private:
+        friend class HNSW;
+        using MinHeap = std::priority_queue<Scored, std::vector<Scored>, std::greater<Scored>>;
+
+        SearchIterator(const HNSW &index, std::span<const float> query, int ef);
+        void visit(int id, size_t target);
+        void expand(size_t target);
+
+        const HNSW *index_;
+        std::vector<float> query_;// own copy, the caller's buffer may not outlive the iterator
+        int ef_;
+        size_t returned_ = 0;
+        std::vector<bool> visited_;
+        MinHeap cand_;                   // frontier, never truncated so expansion can resume
+        MinHeap pool_;                   // discovered but not yet returned
+        std::priority_queue<Scored> bound_;// best `target` distances seen, drives termination
+        MinHeap overflow_;               // evicted from bound_, refilled when target grows
+    };
+
+    SearchIterator search_iterator(std::span<const float> query, int ef_search = -1) const {
+        return SearchIterator(*this, query, (ef_search > 0) ? ef_search : ef_);
+    }
 
 private:
+    friend class DiskHNSW;// lays out the graph on disk
+
     int dim_, M_, ef_;
+    float alpha_ = 1.0f;     // neighbor selection, see prune_neighbors_heuristic
+    bool keep_pruned_ = false;
     std::vector<std::unique_ptr<Node>> nodes_;// Unique_ptr ensures stable memory addresses
     std::atomic<int> entry_point_;
     std::atomic<int> max_level_;
+    std::atomic<size_t> insert_dist_evals_{0};
     mutable std::shared_mutex global_lock_;// For adding to nodes_ vector and max_level
 
+    // Live save(): copy-on-write of adjacency. save() fixes a cut (the nodes below the first one
+    // an insert is still linking, an entry point and max level among them) and publishes an
+    // epoch; an insert about to change the links of a node below the cut that save() has not
+    // captured yet first copies them aside. Either way the image gets each node's links as of
+    // the cut.
+    mutable std::mutex snap_mutex_;               // one save() at a time
+    mutable std::atomic<uint64_t> snap_state_{0}; // epoch << 32 | cut while a save() runs, else 0
+    mutable uint32_t snap_epochs_ = 0;
+    mutable size_t snap_linked_ = 0;              // nodes below this are linked for good
+
+    // Vector store: STORE_BLOCK rows of dim_ floats per block. Blocks never move, so Node::vec
+    // stays valid while the store grows, and inserts allocate once per block, not per vector.
+    static constexpr size_t STORE_BLOCK = 4096;
+    std::vector<std::unique_ptr<float[]>> store_;
+    size_t stored_ = 0;
+
+    // Copies v into the store; the caller holds global_lock_ exclusively (or builds alone)
+    std::span<const float> store_vector(std::span<const float> v) {
+        if (v.size() != (size_t) dim_) throw std::invalid_argument("HNSW: vector dimension mismatch");
+        if (stored_ % STORE_BLOCK == 0) store_.push_back(std::make_unique_for_overwrite<float[]>(STORE_BLOCK * dim_));
+        float *dst = store_.back().get() + (stored_++ % STORE_BLOCK) * dim_;
+        std::copy(v.begin(), v.end(), dst);
+        return {dst, v.size()};
+    }
+
+    // insert_batch body: row i gets label_of(i). Grows the graph in parallel waves of at most
+    // size() / WAVE_RATIO rows, to the last row, so a wave never makes up more than a small
+    // fraction of the graph it links into; an empty index takes its first 16 rows one at a
+    // time, then grows by ~12% per wave.
+    template<class GetRow, class LabelOf>
+    void insert_rows(size_t n, GetRow &get_row, LabelOf &&label_of, int num_threads) {
+        if (n == 0) return;
+        const size_t graph0 = size();
+        auto tp = pool(num_threads);
+        std::vector<std::vector<float>> bufs(tp.size());
+        auto insert_row = [&](size_t idx, int slot) {
+            insert_internal(get_row(idx, bufs[slot]), label_of(idx));
+        };
+
+        size_t i = 0;
+        while (i < n) {
+            size_t wave = std::min(n - i, std::max<size_t>(1, (graph0 + i) / WAVE_RATIO));
+            tp.parallel_for(i, i + wave, insert_row);
+            i += wave;
+        }
+    }
+
+    // Row count of a row-major matrix of dim_ columns
+    size_t matrix_rows(std::span<const float> rows) const {
+        if (rows.size() % dim_ != 0) throw std::invalid_argument("HNSW: matrix size is not a multiple of dim");
+        return rows.size() / dim_;
+    }
+
+    // insert_batch: concurrent inserts stay below 1 / WAVE_RATIO of the graph
+    static constexpr size_t WAVE_RATIO = 8;
+
+    // search_interleaved: queries per parallel_for item, per in-flight search
+    static constexpr size_t INTERLEAVE_BLOCK = 16;
+
+    // Batch insert / search workers, created on first use
+    mutable std::mutex pool_mutex_;
+    mutable std::shared_ptr<ThreadPool> pool_;
+    bool pool_shared_ = false;// set_thread_pool() was called
+
+    // The pool as one batch call uses it: at most `width` slots wide
+    struct PoolRef {
+        std::shared_ptr<ThreadPool> tp;
+        int width;
+
+        int size() const { return width; }
+        template<class F>
+        void parallel_for(size_t begin, size_t end, F &&fn) const {
+            tp->parallel_for(begin, end, std::forward<F>(fn), width);
+        }
+    };
+
+    // An owned pool is created once, as wide as the first request or the hardware, and each
+    // call runs on num_threads of it (capped at its size); a shared pool is used whole
+    PoolRef pool(int num_threads) const {
+        std::lock_guard lock(pool_mutex_);
+        num_threads = std::max(1, num_threads);
+        if (!pool_)
+            pool_ = std::make_shared<ThreadPool>(std::max<int>(num_threads, std::thread::hardware_concurrency()));
+        return {pool_, pool_shared_ ? pool_->size() : std::min(num_threads, pool_->size())};
+    }
+
     // Thread-local visited list for 0-contention search
     struct VisitedList {
         std::vector<unsigned int> list;
@@ -76,40 +440,135 @@ private:
     };
     static thread_local VisitedList tl_visited;
 
+    // search_multi: per node, the version it was last touched in and one visited bit per query
+    struct MultiVisitedList {
+        std::vector<std::pair<unsigned int, uint32_t>> list;
+        unsigned int version = 0;
+    };
+    static thread_local MultiVisitedList tl_multi_visited;
+    static thread_local size_t tl_dist_evals;
+#ifdef HNSW_SEARCH_STATS
+    static thread_local SearchStats *tl_stats;// set by search() for the duration of the call
+
+    // Routes the layer-search hooks into `stats` and records wall time on exit. dist_evals
+    // always has a layer 0 slot, even for an empty index (levels == 0).
+    struct StatsScope {
+        SearchStats *stats;
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+        StatsScope(SearchStats *s, int levels) : stats(s) {
+            tl_stats = s;
+            if (s) *s = SearchStats{std::vector<size_t>(std::max(levels, 1), 0)};
+        }
+        ~StatsScope() {
+            if (stats) stats->wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            tl_stats = nullptr;
+        }
+    };
+#endif
+
     void prepare_visited_list() const {
         if (tl_visited.list.size() < nodes_.size() + 1024) {
             tl_visited.list.resize(nodes_.size() + 8192, 0);
+            HNSW_STAT(if (tl_stats) tl_stats->visited_resets++);
         }
         if (++tl_visited.version == 0) {
             std::fill(tl_visited.list.begin(), tl_visited.list.end(), 0);
             tl_visited.version = 1;
+            HNSW_STAT(if (tl_stats) tl_stats->visited_resets++);
         }
     }
 
-    void insert_internal(const std::vector<float> &vec);
-    std::vector<int> search_layer_internal(const std::vector<float> &q, int entry, int level, int ef) const;
-    void prune_neighbors_heuristic(int base_id, std::vector<int> &neighbors);
+    // Optional knobs for search_layer_internal beyond the plain ef beam
+    struct LayerSearchOpts {
+        float radius2 = -1.0f;      // range search: every hit within this squared distance widens the beam
+        int max_in_radius = INT_MAX;//   ... up to this many hits
+        int k = 0;                  // adaptive termination: stop once the best k
+        int patience = 0;           //   have not improved for this many expansions
+    };
+
+    // NN-Descent (bulk build) parameters
+    static constexpr size_t NND_MAX_ITERS = 12;
+    static constexpr float NND_SAMPLE = 0.3f;     // fraction of K joined per node and iteration
+    static constexpr float NND_DELTA = 0.001f;    // stop below this many updates per N * K
+    static constexpr size_t NND_BRUTE_FORCE = 1024;// exact kNN for layers up to this size
+
+    static int random_level();
+    void insert_internal(std::span<const float> vec, int label);
+    void build_layers(const PoolRef &tp);
+    std::vector<std::vector<Scored>> nn_descent(const std::vector<int> &ids, size_t K, const PoolRef &tp) const;
+    void build_flat(const VamanaParams &vp, const PoolRef &tp);
+    std::vector<Scored> robust_prune(int base_id, std::vector<Scored> &cand, float alpha, size_t R) const;
+    int greedy_descend(std::span<const float> q, int ep, int from_level, int to_level) const;
+    std::vector<Scored> search_layer_internal(std::span<const float> q, int entry, int level, int ef,
+                                              const LayerSearchOpts &opts) const;
+    std::vector<Scored> search_layer_internal(std::span<const float> q, int entry, int level, int ef) const {
+        return search_layer_internal(q, entry, level, ef, LayerSearchOpts{});
+    }
+    std::vector<Scored> prune_neighbors_heuristic(int base_id, std::vector<Scored> &cand) const;
+    void search_group(const float *const *qs, int nq, int k, int ef, std::vector<int> *out) const;
+    CoTask search_walker(std::span<const float> queries, size_t &next, size_t end, int k, int ef,
+                         std::vector<std::vector<int>> &res) const;
+    std::vector<std::vector<Scored>> search_layer_multi(const float *const *qs, int nq, const int *entry,
+                                                        int level, int ef) const;
+
+    // Called with node_mutex held exclusively, before node `id`'s links change
+    void preserve_links(int id, Node &node) const {
+        const uint64_t state = snap_state_.load(std::memory_order_acquire);
+        const uint32_t e = uint32_t(state >> 32), cut = uint32_t(state);
+        if (e == 0 || (uint32_t) id >= cut || node.snap_epoch.load(std::memory_order_relaxed) == e) return;
+        node.snap_before = std::make_unique<LinkImage>(LinkImage{node.neighbors, node.dists});
+        node.snap_epoch.store(e, std::memory_order_relaxed);
+    }
+
+    // A node's links on one level with their cached distances. The caller holds node_mutex
+    // (exclusively for the writers).
+    static std::vector<Scored> scored_links(const Node &node, int level);
+    static void set_links(Node &node, int level, const std::vector<Scored> &links);
+    static void add_link(Node &node, int level, int id, float d) {
+        node.neighbors[level].push_back(id);
+        node.dists[level].push_back(d);
+    }
+    // Re-prunes `id`'s list on `level` once it exceeds the level's cap, from the cached distances
+    void shrink_links(int id, int level) {
+        Node &node = *nodes_[id];
+        if (node.neighbors[level].size() <= (size_t) ((level == 0) ? M_ * 2 : M_)) return;
+        auto cand = scored_links(node, level);
+        set_links(node, level, prune_neighbors_heuristic(id, cand));
+    }
 };
 
 // Thread-local storage definition
 thread_local HNSW::VisitedList HNSW::tl_visited;
+thread_local HNSW::MultiVisitedList HNSW::tl_multi_visited;
+thread_local size_t HNSW::tl_dist_evals = 0;
+#ifdef HNSW_SEARCH_STATS
+thread_local SearchStats *HNSW::tl_stats = nullptr;
+#endif
 
-inline void HNSW::insert_internal(const std::vector<float> &vec) {
-    // Generate level
+inline int HNSW::random_level() {
     static thread_local std::mt19937 gen(std::random_device{}());
     std::uniform_real_distribution<float> dist(0.0f, 1.0f);
     int lvl = 0;
     while (dist(gen) < 0.5f && lvl < 16) ++lvl;
+    return lvl;
+}
+
+inline void HNSW::insert_internal(std::span<const float> vec, int label) {
+    int lvl = random_level();
+    const size_t evals0 = tl_dist_evals;
 
     int new_id;
     int curr_ep;
     int max_l;
 
-    // 1. Register new node
+    // 1. Register new node, flagged as being linked until this call returns (save() cuts below it)
+    Node *self;
     {
         std::unique_lock lock(global_lock_);
         new_id = nodes_.size();
-        nodes_.push_back(std::make_unique<Node>(vec, lvl));
+        nodes_.push_back(std::make_unique<Node>(store_vector(vec), lvl, label < 0 ? new_id : label));
+        self = nodes_.back().get();
         curr_ep = entry_point_.load();
         max_l = max_level_.load();
 
@@ -118,34 +577,45 @@ inline void HNSW::insert_internal(const std::vector<float> &vec) {
             max_level_ = lvl;
             return;
         }
+        self->linked.store(false, std::memory_order_relaxed);
     }
+    struct MarkLinked {
+        Node &node;
+        ~MarkLinked() { node.linked.store(true, std::memory_order_release); }
+    } mark_linked{*self};
 
     // 2. Greedy search down to lvl
-    int ep = curr_ep;
-    for (int l = max_l; l > lvl; --l) {
-        auto res = search_layer_internal(vec, ep, l, 1);
-        if (!res.empty()) ep = res[0];
-    }
+    int ep = greedy_descend(vec, curr_ep, max_l, lvl);
 
     // 3. Connect layers
     for (int l = std::min(lvl, max_l); l >= 0; --l) {
         auto candidates = search_layer_internal(vec, ep, l, ef_);
+        if (candidates.empty()) continue;
+        ep = candidates[0].second;
 
-        // Node's outgoing neighbors (No lock needed for self initialization)
-        nodes_[new_id]->neighbors[l] = candidates;
-        prune_neighbors_heuristic(new_id, nodes_[new_id]->neighbors[l]);
+        // Node's outgoing neighbors, scored by the layer search. Built aside and merged in under
+        // the node lock: once a higher layer is linked, concurrent inserts can already reach this
+        // node, descend from it and link themselves into this level's list. Replacing the list
+        // would drop those links and leave their nodes unreachable.
+        auto links = prune_neighbors_heuristic(new_id, candidates);
+        {
+            std::unique_lock own_lock(self->node_mutex);
+            preserve_links(new_id, *self);
+            auto &have = self->neighbors[l];
+            for (auto &[d, id]: links)
+                if (std::find(have.begin(), have.end(), id) == have.end()) add_link(*self, l, id, d);
+            shrink_links(new_id, l);
+        }
 
-        // Link neighbors TO new node (Locking neighbors)
-        std::vector<int> final_n_ids = nodes_[new_id]->neighbors[l];
-        for (int nb: final_n_ids) {
+        // Link neighbors TO new node (Locking neighbors); the distance is symmetric
+        for (auto &[d, nb]: links) {
             std::unique_lock nb_lock(nodes_[nb]->node_mutex);
-            nodes_[nb]->neighbors[l].push_back(new_id);
-            if (nodes_[nb]->neighbors[l].size() > (size_t) ((l == 0) ? M_ * 2 : M_)) {
-                prune_neighbors_heuristic(nb, nodes_[nb]->neighbors[l]);
-            }
+            preserve_links(nb, *nodes_[nb]);
+            add_link(*nodes_[nb], l, new_id, d);
+            shrink_links(nb, l);
         }
-        if (!candidates.empty()) ep = candidates[0];
     }
+    insert_dist_evals_.fetch_add(tl_dist_evals - evals0, std::memory_order_relaxed);
 
     // 4. Update global peak
     if (lvl > max_l) {
@@ -157,13 +627,298 @@ inline void HNSW::insert_internal(const std::vector<float> &vec) {
     }
 }
 
-inline std::vector<int> HNSW::search_layer_internal(const std::vector<float> &q, int entry, int level, int ef) const {
-    using PQElem = std::pair<float, int>;
-    std::priority_queue<PQElem> top;
-    std::priority_queue<PQElem, std::vector<PQElem>, std::greater<PQElem>> cand;
+inline int HNSW::greedy_descend(std::span<const float> q, int ep, int from_level, int to_level) const {
+    for (int l = from_level; l > to_level; --l) {
+        auto res = search_layer_internal(q, ep, l, 1);
+        if (!res.empty()) ep = res[0].second;
+    }
+    return ep;
+}
+
+// Bulk build, top layer first. Each layer is the subset of nodes at that level or above:
+// kNN lists from NN-Descent, pruned to M with the insert heuristic as forward links, then
+// every forward link is mirrored back, pruning lists that exceed the layer's cap, exactly
+// as insert_internal links a new node.
+inline void HNSW::build_layers(const PoolRef &tp) {
+    int top = -1;
+    for (auto &node: nodes_) top = std::max(top, node->level);
+
+    for (int l = top; l >= 0; --l) {
+        std::vector<int> ids;
+        for (int i = 0; i < (int) nodes_.size(); i++)
+            if (nodes_[i]->level >= l) ids.push_back(i);
+        if (ids.size() < 2) continue;
+
+        auto links = nn_descent(ids, (l == 0) ? M_ * 2 : M_, tp);
+        tp.parallel_for(0, ids.size(), [&](size_t i, int) {
+            links[i] = prune_neighbors_heuristic(ids[i], links[i]);
+            std::unique_lock lock(nodes_[ids[i]]->node_mutex);
+            set_links(*nodes_[ids[i]], l, links[i]);
+        });
+
+        tp.parallel_for(0, ids.size(), [&](size_t i, int) {
+            for (auto &[d, nb]: links[i]) {
+                std::unique_lock nb_lock(nodes_[nb]->node_mutex);
+                auto &back = nodes_[nb]->neighbors[l];
+                if (std::find(back.begin(), back.end(), ids[i]) != back.end()) continue;
+                add_link(*nodes_[nb], l, ids[i], d);
+                shrink_links(nb, l);
+            }
+        });
+    }
+
+    for (int i = 0; i < (int) nodes_.size(); i++) {
+        if (nodes_[i]->level == top) {
+            entry_point_ = i;
+            max_level_ = top;
+            break;
+        }
+    }
+}
+
+// NN-Descent (Dong, Charikar, Li, WWW'11): starting from random lists, repeatedly compare
+// pairs of each node's neighbors ("a neighbor of a neighbor is likely a neighbor") and keep
+// the K closest. Each round joins only a sample of the entries that are new since the last
+// round, plus reverse neighbors. Returns the approximate K nearest of every ids[i] as scored
+// node ids, closest first. Small layers are solved exactly.
+inline std::vector<std::vector<HNSW::Scored>> HNSW::nn_descent(const std::vector<int> &ids, size_t K, const PoolRef &tp) const {
+    const size_t n = ids.size();
+    K = std::min(K, n - 1);
+    auto dist = [&](size_t a, size_t b) {
+        ++tl_dist_evals;
+        return l2_distance(nodes_[ids[a]]->vec, nodes_[ids[b]]->vec);
+    };
+    std::vector<std::vector<Scored>> res(n);
+
+    if (n <= NND_BRUTE_FORCE) {
+        tp.parallel_for(0, n, [&](size_t i, int) {
+            std::vector<Scored> all;
+            for (size_t j = 0; j < n; j++)
+                if (j != i) all.emplace_back(dist(i, j), ids[j]);
+            std::partial_sort(all.begin(), all.begin() + K, all.end());
+            res[i].assign(all.begin(), all.begin() + K);
+        });
+        return res;
+    }
+
+    struct Entry {
+        float d;
+        int id;// index into ids
+        bool fresh;// not yet joined
+        bool operator<(const Entry &o) const { return d < o.d; }
+    };
+    struct Pool {
+        std::mutex m;
+        std::vector<Entry> heap;// max-heap on d, at most K entries
+        std::atomic<float> worst{std::numeric_limits<float>::max()};// heap top once full
+    };
+    std::vector<Pool> pools(n);
+
+    auto update = [&](size_t a, size_t b, float d) -> bool {
+        Pool &p = pools[a];
+        if (d >= p.worst.load(std::memory_order_relaxed)) return false;// most joins end here, lock-free
+        std::lock_guard lock(p.m);
+        if (p.heap.size() >= K && d >= p.heap.front().d) return false;
+        for (const Entry &e: p.heap)
+            if (e.id == (int) b) return false;
+        if (p.heap.size() >= K) {
+            std::pop_heap(p.heap.begin(), p.heap.end());
+            p.heap.pop_back();
+        }
+        p.heap.push_back({d, (int) b, true});
+        std::push_heap(p.heap.begin(), p.heap.end());
+        if (p.heap.size() >= K) p.worst.store(p.heap.front().d, std::memory_order_relaxed);
+        return true;
+    };
+
+    tp.parallel_for(0, n, [&](size_t i, int) {
+        std::mt19937 rng(uint32_t(i) * 2654435761u);
+        while (pools[i].heap.size() < K) {
+            size_t j = rng() % n;
+            if (j != i) update(i, j, dist(i, j));
+        }
+    });
+
+    const size_t sample = std::max<size_t>(1, size_t(NND_SAMPLE * K));
+    std::vector<std::vector<int>> fresh(n), old(n), rfresh(n), rold(n);
+    for (size_t iter = 0; iter < NND_MAX_ITERS; iter++) {
+        // Sample the fresh entries to join this round and mark them joined
+        tp.parallel_for(0, n, [&](size_t i, int) {
+            fresh[i].clear(), old[i].clear(), rfresh[i].clear(), rold[i].clear();
+            for (Entry &e: pools[i].heap) {
+                if (!e.fresh) {
+                    if (old[i].size() < sample) old[i].push_back(e.id);
+                } else if (fresh[i].size() < sample) {
+                    fresh[i].push_back(e.id);
+                    e.fresh = false;
+                }
+            }
+        });
+        // Reverse lists, capped at the same sample size
+        tp.parallel_for(0, n, [&](size_t i, int) {
+            for (int j: fresh[i]) {
+                std::lock_guard lock(pools[j].m);
+                if (rfresh[j].size() < sample) rfresh[j].push_back(i);
+            }
+            for (int j: old[i]) {
+                std::lock_guard lock(pools[j].m);
+                if (rold[j].size() < sample) rold[j].push_back(i);
+            }
+        });
+        // Local join: fresh x fresh and fresh x old
+        std::atomic<size_t> updates(0);
+        tp.parallel_for(0, n, [&](size_t i, int) {
+            auto merge = [](std::vector<int> a, const std::vector<int> &b) {
+                a.insert(a.end(), b.begin(), b.end());
+                std::sort(a.begin(), a.end());
+                a.erase(std::unique(a.begin(), a.end()), a.end());
+                return a;
+            };
+            std::vector<int> nf = merge(fresh[i], rfresh[i]), no = merge(old[i], rold[i]);
+            size_t c = 0;
+            for (size_t x = 0; x < nf.size(); x++) {
+                for (size_t y = x + 1; y < nf.size(); y++) {
+                    float d = dist(nf[x], nf[y]);
+                    c += update(nf[x], nf[y], d) + update(nf[y], nf[x], d);
+                }
+                for (int o: no) {
+                    if (o == nf[x]) continue;
+                    float d = dist(nf[x], o);
+                    c += update(nf[x], o, d) + update(o, nf[x], d);
+                }
+            }
+            updates += c;
+        });
+        if (updates < NND_DELTA * n * K) break;
+    }
+
+    tp.parallel_for(0, n, [&](size_t i, int) {
+        auto &h = pools[i].heap;
+        std::sort_heap(h.begin(), h.end());
+        for (const Entry &e: h) res[i].emplace_back(e.d, ids[e.id]);
+    });
+    return res;
+}
+
+// Vamana: random R-regular start, then two passes over the nodes in random order (alpha = 1,
+// then vp.alpha). Each pass searches for the node from the medoid, RobustPrunes the beam plus
+// its current links into its new links, and adds the reverse links, re-pruning any list
+// that grows past R.
+inline void HNSW::build_flat(const VamanaParams &vp, const PoolRef &tp) {
+    const size_t n = nodes_.size();
+    if (n == 0) return;
+    const size_t R = std::min<size_t>(vp.R, n - 1);
+
+    // Medoid: the node closest to the centroid
+    std::vector<float> centroid(dim_, 0.0f);
+    for (auto &node: nodes_)
+        for (int j = 0; j < dim_; j++) centroid[j] += node->vec[j] / n;
+    int medoid = 0;
+    float best = std::numeric_limits<float>::max();
+    for (size_t i = 0; i < n; i++) {
+        float d = l2_distance(centroid, nodes_[i]->vec);
+        if (d < best) best = d, medoid = (int) i;
+    }
+    entry_point_ = medoid;
+    max_level_ = 0;
+
+    tp.parallel_for(0, n, [&](size_t i, int) {
+        std::mt19937 rng(uint32_t(i) * 2654435761u);
+        Node &node = *nodes_[i];
+        while (node.neighbors[0].size() < R) {
+            int j = (int) (rng() % n);
+            if (j != (int) i && std::find(node.neighbors[0].begin(), node.neighbors[0].end(), j) == node.neighbors[0].end())
+                add_link(node, 0, j, l2_distance(node.vec, nodes_[j]->vec));
+        }
+    });
+
+    std::vector<int> order(n);
+    for (size_t i = 0; i < n; i++) order[i] = (int) i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(12345));
+
+    for (float alpha: {1.0f, std::max(1.0f, vp.alpha)}) {
+        tp.parallel_for(0, n, [&](size_t k, int) {
+            int p = order[k];
+            const auto &vec = nodes_[p]->vec;
+            auto cand = search_layer_internal(vec, medoid, 0, std::max<int>(vp.L, R));
+            {
+                std::shared_lock own_read(nodes_[p]->node_mutex);
+                auto own = scored_links(*nodes_[p], 0);
+                cand.insert(cand.end(), own.begin(), own.end());
+            }
+            auto links = robust_prune(p, cand, alpha, R);
+            {
+                std::unique_lock own_lock(nodes_[p]->node_mutex);
+                set_links(*nodes_[p], 0, links);
+            }
+
+            for (auto &[d, nb]: links) {
+                std::unique_lock nb_lock(nodes_[nb]->node_mutex);
+                Node &node = *nodes_[nb];
+                auto &back = node.neighbors[0];
+                if (std::find(back.begin(), back.end(), p) != back.end()) continue;
+                if (back.size() < R) {
+                    add_link(node, 0, p, d);
+                    continue;
+                }
+                auto nb_cand = scored_links(node, 0);
+                nb_cand.emplace_back(d, p);
+                set_links(node, 0, robust_prune(nb, nb_cand, alpha, R));
+            }
+        });
+    }
+}
+
+// RobustPrune: closest candidate first; every later candidate v is dropped once some kept
+// neighbor s is alpha times closer to it than the base is (alpha * |s - v| < |base - v|,
+// i.e. alpha^2 on the squared distances). alpha = 1 is the HNSW heuristic; larger alpha
+// keeps more long links. Each (s, v) pair is evaluated at most once; the base distances come
+// from cand. Returns the kept candidates, closest first. Sorts and dedups cand in place.
+inline std::vector<HNSW::Scored> HNSW::robust_prune(int base_id, std::vector<Scored> &cand, float alpha, size_t R) const {
+    std::sort(cand.begin(), cand.end());
+    cand.erase(std::unique(cand.begin(), cand.end(), [](const Scored &a, const Scored &b) {
+                   return a.second == b.second;
+               }),
+               cand.end());
+    const float alpha2 = alpha * alpha;
+
+    std::vector<Scored> selected;
+    for (auto &[d, id]: cand) {
+        if (id == base_id) continue;
+        bool good = true;
+        for (auto &s: selected) {
+            ++tl_dist_evals;
+            if (alpha2 * l2_distance(nodes_[s.second]->vec, nodes_[id]->vec) < d) {
+                good = false;
+                break;
+            }
+        }
+        if (good) selected.emplace_back(d, id);
+        if (selected.size() >= R) break;
+    }
+    return selected;
+}
+
+// Beam search on one layer. Returns up to ef nodes sorted by distance.
+// With opts.radius2 >= 0 every node within that squared distance also widens the beam by one
+// (up to max_in_radius), so the frontier keeps ef nodes of slack beyond the radius.
+// With opts.patience > 0 the search also ends once the best opts.k distances have not
+// changed for that many consecutive expansions.
+inline std::vector<HNSW::Scored> HNSW::search_layer_internal(std::span<const float> q, int entry, int level, int ef,
+                                                             const LayerSearchOpts &opts) const {
+    std::priority_queue<Scored> top;
+    std::priority_queue<Scored, std::vector<Scored>, std::greater<Scored>> cand;
+    std::priority_queue<float> best_k;// only maintained when patience is set
+    size_t cap = ef;
+    int in_radius = 0;
+    int stale = 0;
 
     prepare_visited_list();
     float d0 = l2_distance(q, nodes_[entry]->vec);
+    ++tl_dist_evals;
+    HNSW_STAT(if (tl_stats) tl_stats->dist_evals[level]++, tl_stats->heap_pushes += 2);
+    if (d0 <= opts.radius2 && in_radius < opts.max_in_radius) ++in_radius, ++cap;
+    if (opts.patience > 0) best_k.push(d0);
     top.emplace(d0, entry);
     cand.emplace(d0, entry);
     tl_visited.list[entry] = tl_visited.version;
@@ -172,7 +927,8 @@ inline std::vector<int> HNSW::search_layer_internal(const std::vector<float> &q,
         auto [d_curr, curr] = cand.top();
         cand.pop();
 
-        if (top.size() >= (size_t) ef && d_curr > top.top().first) break;
+        if (top.size() >= cap && d_curr > top.top().first) break;
+        HNSW_STAT(if (tl_stats) tl_stats->nodes_expanded++);
 
         // Copy neighbors under shared lock to minimize blocking
         std::vector<int> nbs;
@@ -182,66 +938,540 @@ inline std::vector<int> HNSW::search_layer_internal(const std::vector<float> &q,
                 nbs = nodes_[curr]->neighbors[level];
         }
 
+        bool improved = false;
         for (int nb: nbs) {
             if (tl_visited.list[nb] == tl_visited.version) continue;
             tl_visited.list[nb] = tl_visited.version;
 
             float d = l2_distance(q, nodes_[nb]->vec);
-            if (top.size() < (size_t) ef || d < top.top().first) {
+            ++tl_dist_evals;
+            HNSW_STAT(if (tl_stats) tl_stats->dist_evals[level]++);
+            if (d <= opts.radius2 && in_radius < opts.max_in_radius) ++in_radius, ++cap;
+            if (top.size() < cap || d < top.top().first) {
                 cand.emplace(d, nb);
                 top.emplace(d, nb);
-                if (top.size() > (size_t) ef) top.pop();
+                HNSW_STAT(if (tl_stats) tl_stats->heap_pushes += 2);
+                if (top.size() > cap) top.pop();
+
+                if (opts.patience > 0 && (best_k.size() < (size_t) opts.k || d < best_k.top())) {
+                    best_k.push(d);
+                    if (best_k.size() > (size_t) opts.k) best_k.pop();
+                    improved = true;
+                }
             }
         }
+
+        if (opts.patience > 0) {
+            stale = improved ? 0 : stale + 1;
+            if (stale >= opts.patience) break;
+        }
     }
 
+    std::vector<Scored> res(top.size());
+    for (size_t i = res.size(); i-- > 0; top.pop()) res[i] = top.top();
+    return res;
+}
+
+// HNSW neighbor selection (Malkov & Yashunin, Alg. 4) via robust_prune with alpha_:
+// alpha_ = 1 is the original rule, larger keeps more long-range links. With keep_pruned_
+// the candidates it skipped backfill the list up to M, closest first, so clustered data
+// does not leave nodes with only a handful of links. cand holds the candidates' distances to
+// base_id, so no base distance is recomputed; lists shorter than M are returned as they are.
+inline std::vector<HNSW::Scored> HNSW::prune_neighbors_heuristic(int base_id, std::vector<Scored> &cand) const {
+    if (cand.size() < (size_t) M_) return cand;
+
+    std::vector<Scored> selected = robust_prune(base_id, cand, alpha_, M_);
+    if (keep_pruned_) {
+        for (auto &[d, id]: cand) {
+            if (selected.size() >= (size_t) M_) break;
+            if (id == base_id) continue;
+            if (std::none_of(selected.begin(), selected.end(), [&](const Scored &s) { return s.second == id; }))
+                selected.emplace_back(d, id);
+        }
+    }
+    return selected;
+}
+
+inline std::vector<HNSW::Scored> HNSW::scored_links(const Node &node, int level) {
+    std::vector<Scored> res;
+    res.reserve(node.neighbors[level].size());
+    for (size_t i = 0; i < node.neighbors[level].size(); i++)
+        res.emplace_back(node.dists[level][i], node.neighbors[level][i]);
+    return res;
+}
+
+inline void HNSW::set_links(Node &node, int level, const std::vector<Scored> &links) {
+    auto &ids = node.neighbors[level];
+    auto &ds = node.dists[level];
+    ids.clear(), ds.clear();
+    for (auto &[d, id]: links) ids.push_back(id), ds.push_back(d);
+}
+
+inline std::vector<int> HNSW::search(std::span<const float> query, int k, int ef_search, int patience,
+                                     SearchStats *stats) const {
+    auto scored = search_scored(query, k, ef_search, patience, stats);
     std::vector<int> res;
-    while (!top.empty()) {
-        res.push_back(top.top().second);
-        top.pop();
+    res.reserve(scored.size());
+    for (auto &[d, label]: scored) res.push_back(label);
+    return res;
+}
+
+inline std::vector<HNSW::Scored> HNSW::search_scored(std::span<const float> query, int k, int ef_search, int patience,
+                                                    [[maybe_unused]] SearchStats *stats) const {
+    std::shared_lock lock(global_lock_);
+    HNSW_STAT(StatsScope stats_scope(stats, max_level_.load() + 1));
+    int ep = entry_point_.load();
+    if (ep == -1) return {};
+
+    int ef = (ef_search > 0) ? ef_search : std::max(ef_, k);
+    ep = greedy_descend(query, ep, max_level_.load(), 0);
+
+    LayerSearchOpts opts;
+    opts.k = k;
+    opts.patience = patience;
+    auto candidates = search_layer_internal(query, ep, 0, ef, opts);
+    if (candidates.size() > (size_t) k) candidates.resize(k);
+    for (auto &[d, id]: candidates) id = nodes_[id]->label;
+    return candidates;
+}
+
+// search() for a group of queries in lockstep: greedy descent with ef = 1, then the layer-0 beam
+inline void HNSW::search_group(const float *const *qs, int nq, int k, int ef, std::vector<int> *out) const {
+    std::shared_lock lock(global_lock_);
+    int ep = entry_point_.load();
+    if (ep == -1) return;
+
+    std::vector<int> entry(nq, ep);
+    for (int l = max_level_.load(); l > 0; --l) {
+        auto res = search_layer_multi(qs, nq, entry.data(), l, 1);
+        for (int q = 0; q < nq; q++)
+            if (!res[q].empty()) entry[q] = res[q][0].second;
+    }
+
+    auto res = search_layer_multi(qs, nq, entry.data(), 0, ef);
+    for (int q = 0; q < nq; q++) {
+        if (res[q].size() > (size_t) k) res[q].resize(k);
+        out[q].clear();
+        for (auto &[d, id]: res[q]) out[q].push_back(nodes_[id]->label);
+    }
+}
+
+// search_layer_internal for nq queries at once. Every round each unfinished query pops its
+// closest candidate; the popped nodes are grouped, so a node popped by several queries has
+// its neighbor list copied once, and each unvisited neighbor vector is loaded once and scored
+// against all of those queries by l2_distance_multi, which sums in l2_distance's order. Per
+// query, the distances, expansion order, visited set and termination are therefore those of
+// search_layer_internal.
+inline std::vector<std::vector<HNSW::Scored>> HNSW::search_layer_multi(const float *const *qs, int nq, const int *entry,
+                                                                      int level, int ef) const {
+    using MinHeap = std::priority_queue<Scored, std::vector<Scored>, std::greater<Scored>>;
+    std::vector<std::priority_queue<Scored>> top(nq);
+    std::vector<MinHeap> cand(nq);
+
+    auto &vis = tl_multi_visited;
+    if (vis.list.size() < nodes_.size() + 1024) vis.list.resize(nodes_.size() + 8192, {0u, 0u});
+    if (++vis.version == 0) {
+        std::fill(vis.list.begin(), vis.list.end(), std::pair<unsigned int, uint32_t>{0u, 0u});
+        vis.version = 1;
+    }
+    // Marks `mask` visited at id; returns the bits that were not set yet
+    auto visit = [&](int id, uint32_t mask) {
+        auto &[version, bits] = vis.list[id];
+        if (version != vis.version) version = vis.version, bits = 0;
+        uint32_t fresh = mask & ~bits;
+        bits |= mask;
+        return fresh;
+    };
+
+    for (int q = 0; q < nq; q++) {
+        float d = l2_distance(qs[q], nodes_[entry[q]]->vec.data(), dim_);
+        visit(entry[q], 1u << q);
+        top[q].emplace(d, entry[q]);
+        cand[q].emplace(d, entry[q]);
+    }
+    tl_dist_evals += nq;
+
+    std::vector<std::pair<int, int>> step;// (node, query) expanded this round
+    std::vector<int> nbs;
+    const float *sub[MULTI_MAX];
+    int who[MULTI_MAX];
+    float dist[MULTI_MAX];
+    while (true) {
+        step.clear();
+        for (int q = 0; q < nq; q++) {
+            if (cand[q].empty()) continue;
+            auto [d_curr, curr] = cand[q].top();
+            if (top[q].size() >= (size_t) ef && d_curr > top[q].top().first) {
+                cand[q] = MinHeap();// done
+                continue;
+            }
+            cand[q].pop();
+            step.emplace_back(curr, q);
+        }
+        if (step.empty()) break;
+        std::sort(step.begin(), step.end());
+
+        for (size_t s = 0; s < step.size();) {
+            const int curr = step[s].first;
+            uint32_t group = 0;
+            for (; s < step.size() && step[s].first == curr; s++) group |= 1u << step[s].second;
+
+            {
+                std::shared_lock nb_read(nodes_[curr]->node_mutex);
+                if (level < (int) nodes_[curr]->neighbors.size()) nbs = nodes_[curr]->neighbors[level];
+                else nbs.clear();
+            }
+
+            for (int nb: nbs) {
+                int m = 0;
+                for (uint32_t b = visit(nb, group); b; b &= b - 1) {
+                    who[m] = std::countr_zero(b);
+                    sub[m] = qs[who[m]];
+                    m++;
+                }
+                if (m == 0) continue;
+                l2_distance_multi(nodes_[nb]->vec.data(), sub, m, dim_, dist);
+                tl_dist_evals += m;
+
+                for (int i = 0; i < m; i++) {
+                    const int q = who[i];
+                    if (top[q].size() < (size_t) ef || dist[i] < top[q].top().first) {
+                        cand[q].emplace(dist[i], nb);
+                        top[q].emplace(dist[i], nb);
+                        if (top[q].size() > (size_t) ef) top[q].pop();
+                    }
+                }
+            }
+        }
+    }
+
+    std::vector<std::vector<Scored>> res(nq);
+    for (int q = 0; q < nq; q++) {
+        res[q].resize(top[q].size());
+        for (size_t i = res[q].size(); i-- > 0; top[q].pop()) res[q][i] = top[q].top();
     }
-    std::reverse(res.begin(), res.end());
     return res;
 }
 
-inline void HNSW::prune_neighbors_heuristic(int base_id, std::vector<int> &neighbors) {
-    if (neighbors.size() < (size_t) M_) return;
+// One in-flight search of search_interleaved: takes queries off [next, end) until none are
+// left. Each layer is the beam of search_layer_internal (ef = 1 above layer 0), suspended
+// after the prefetch for each of its three memory steps. The caller holds global_lock_.
+inline CoTask HNSW::search_walker(std::span<const float> queries, size_t &next, size_t end, int k, int ef,
+                                  std::vector<std::vector<int>> &res) const {
+    using MinHeap = std::priority_queue<Scored, std::vector<Scored>, std::greater<Scored>>;
+    VisitedSet visited;
+    std::vector<int> nbs, fresh;
 
-    std::vector<std::pair<float, int>> scored;
-    for (int nb: neighbors) scored.push_back({l2_distance(nodes_[base_id]->vec, nodes_[nb]->vec), nb});
-    std::sort(scored.begin(), scored.end());
+    for (size_t q; (q = next++) < end;) {
+        std::span<const float> query = queries.subspan(q * dim_, dim_);
+        int ep = entry_point_.load();
+        if (ep == -1) co_return;
 
-    std::vector<int> selected;
-    for (auto &pair: scored) {
-        bool good = true;
-        for (int s: selected) {
-            if (l2_distance(nodes_[pair.second]->vec, nodes_[s]->vec) < pair.first) {
-                good = false;
-                break;
+        for (int level = max_level_.load(); level >= 0; --level) {
+            const size_t cap = level ? 1 : ef;
+            std::priority_queue<Scored> top;
+            MinHeap cand;
+            visited.clear();
+            float d0 = l2_distance(query, nodes_[ep]->vec);
+            ++tl_dist_evals;
+            visited.insert(ep);
+            top.emplace(d0, ep);
+            cand.emplace(d0, ep);
+
+            while (!cand.empty()) {
+                auto [d_curr, curr] = cand.top();
+                cand.pop();
+                if (top.size() >= cap && d_curr > top.top().first) break;
+
+                // 1. The adjacency list
+                {
+                    std::shared_lock nb_read(nodes_[curr]->node_mutex);
+                    if (level < (int) nodes_[curr]->neighbors.size()) {
+                        const auto &l = nodes_[curr]->neighbors[level];
+                        prefetch_range(l.data(), l.size() * sizeof(int));
+                    }
+                }
+                co_await std::suspend_always{};
+
+                // 2. Node records of the unvisited neighbors (they point at the vectors)
+                {
+                    std::shared_lock nb_read(nodes_[curr]->node_mutex);
+                    if (level < (int) nodes_[curr]->neighbors.size()) nbs = nodes_[curr]->neighbors[level];
+                    else nbs.clear();
+                }
+                fresh.clear();
+                for (int nb: nbs) {
+                    if (!visited.insert(nb)) continue;
+                    fresh.push_back(nb);
+                    prefetch(nodes_[nb].get());
+                }
+                if (fresh.empty()) continue;
+                co_await std::suspend_always{};
+
+                // 3. Their vectors
+                for (int nb: fresh) prefetch_range(nodes_[nb]->vec.data(), dim_ * sizeof(float));
+                co_await std::suspend_always{};
+
+                for (int nb: fresh) {
+                    float d = l2_distance(query, nodes_[nb]->vec);
+                    ++tl_dist_evals;
+                    if (top.size() < cap || d < top.top().first) {
+                        cand.emplace(d, nb);
+                        top.emplace(d, nb);
+                        if (top.size() > cap) top.pop();
+                    }
+                }
             }
+
+            if (level > 0) {
+                ep = top.top().second;
+                continue;
+            }
+            while (top.size() > (size_t) k) top.pop();
+            res[q].resize(top.size());
+            for (size_t i = top.size(); i-- > 0; top.pop()) res[q][i] = nodes_[top.top().second]->label;
         }
-        if (good) selected.push_back(pair.second);
-        if (selected.size() >= (size_t) M_) break;
     }
-    neighbors.swap(selected);
 }
 
-inline std::vector<int> HNSW::search(const std::vector<float> &query, int k, int ef_search) const {
+inline std::vector<int> HNSW::range_search(std::span<const float> query, float radius,
+                                           int max_results, int ef_search) const {
+    if (!(radius >= 0.0f)) throw std::invalid_argument("HNSW::range_search: radius must be >= 0");
     std::shared_lock lock(global_lock_);
     int ep = entry_point_.load();
-    if (ep == -1) return {};
+    if (ep == -1 || max_results <= 0) return {};
 
-    int ef = (ef_search > 0) ? ef_search : std::max(ef_, k);
-    int max_l = max_level_.load();
+    int ef = (ef_search > 0) ? ef_search : ef_;
+    ep = greedy_descend(query, ep, max_level_.load(), 0);
 
-    for (int l = max_l; l > 0; --l) {
-        auto res = search_layer_internal(query, ep, l, 1);
-        if (!res.empty()) ep = res[0];
+    LayerSearchOpts opts;
+    opts.radius2 = radius * radius;
+    opts.max_in_radius = max_results;
+    auto candidates = search_layer_internal(query, ep, 0, ef, opts);
+
+    std::vector<int> res;
+    for (auto &[d, id]: candidates) {
+        if (d > opts.radius2 || (int) res.size() >= max_results) break;
+        res.push_back(nodes_[id]->label);
     }
+    return res;
+}
 
-    auto candidates = search_layer_internal(query, ep, 0, ef);
-    if (candidates.size() > (size_t) k) candidates.resize(k);
-    return candidates;
+inline HNSW::SearchIterator::SearchIterator(const HNSW &index, std::span<const float> query, int ef)
+    : index_(&index), query_(query.begin(), query.end()), ef_(ef) {
+    std::shared_lock lock(index.global_lock_);
+    int ep = index.entry_point_.load();
+    if (ep == -1) return;
+
+    ep = index.greedy_descend(query_, ep, index.max_level_.load(), 0);
+    visited_.resize(index.nodes_.size());
+    visit(ep, 1);
+}
+
+inline void HNSW::SearchIterator::visit(int id, size_t target) {
+    if ((size_t) id >= visited_.size()) visited_.resize(id + 8192);
+    visited_[id] = true;
+
+    float d = l2_distance(query_, index_->nodes_[id]->vec);
+    ++tl_dist_evals;
+    cand_.emplace(d, id);
+    pool_.emplace(d, id);
+    if (bound_.size() < target || d < bound_.top().first) {
+        bound_.emplace(d, id);
+        if (bound_.size() > target) {
+            overflow_.push(bound_.top());
+            bound_.pop();
+        }
+    } else {
+        overflow_.emplace(d, id);
+    }
+}
+
+// Same beam search as search_layer_internal at level 0 with ef = target, but resumable:
+// nothing is dropped from the frontier and the bound can widen on the next call.
+inline void HNSW::SearchIterator::expand(size_t target) {
+    while (bound_.size() < target && !overflow_.empty()) {
+        bound_.push(overflow_.top());
+        overflow_.pop();
+    }
+
+    while (!cand_.empty()) {
+        auto [d_curr, curr] = cand_.top();
+        if (bound_.size() >= target && d_curr > bound_.top().first) break;
+        cand_.pop();
+
+        std::vector<int> nbs;
+        {
+            const Node &node = *index_->nodes_[curr];
+            std::shared_lock nb_read(node.node_mutex);
+            nbs = node.neighbors[0];
+        }
+
+        for (int nb: nbs) {
+            if ((size_t) nb < visited_.size() && visited_[nb]) continue;
+            visit(nb, target);
+        }
+    }
+}
+
+inline std::vector<int> HNSW::SearchIterator::next(int n) {
+    std::vector<int> res;
+    if (n <= 0) return res;
+
+    std::shared_lock lock(index_->global_lock_);
+    expand(std::max<size_t>(ef_, returned_ + n));
+
+    while ((int) res.size() < n && !pool_.empty()) {
+        res.push_back(index_->nodes_[pool_.top().second]->label);
+        pool_.pop();
+    }
+    returned_ += res.size();
+    return res;
+}
+
+// ------------------------- Persistence -------------------------
+namespace hnsw_io {
+constexpr char MAGIC[8] = {'H', 'N', 'S', 'W', 'I', 'D', 'X', '1'};
+
+template<class T>
+void put(std::ostream &os, const T &v) { os.write(reinterpret_cast<const char *>(&v), sizeof(T)); }
+
+template<class T>
+T get(std::istream &is) {
+    T v;
+    if (!is.read(reinterpret_cast<char *>(&v), sizeof(T))) throw std::runtime_error("HNSW::load: truncated image");
+    return v;
+}
+
+template<class T>
+void get_n(std::istream &is, T *dst, size_t n) {
+    if (!is.read(reinterpret_cast<char *>(dst), n * sizeof(T))) throw std::runtime_error("HNSW::load: truncated image");
+}
+}// namespace hnsw_io
+
+inline void HNSW::save(std::ostream &os) const {
+    std::lock_guard one(snap_mutex_);
+    std::vector<const Node *> nodes;
+    int entry, max_level;
+    uint32_t epoch;
+    {
+        // The cut: the nodes below the first one an insert is still linking in (inserts
+        // register under this lock, in id order). Concurrent inserts keep only a handful of
+        // the newest nodes unlinked, so the image loses at most those.
+        std::unique_lock lock(global_lock_);
+        size_t cut = snap_linked_;
+        while (cut < nodes_.size() && nodes_[cut]->linked.load(std::memory_order_acquire)) cut++;
+        snap_linked_ = cut;
+        for (size_t i = 0; i < cut; i++) nodes.push_back(nodes_[i].get());
+        entry = entry_point_.load();
+        max_level = max_level_.load();
+        if ((size_t) entry >= cut) {
+            // The entry point is above the cut: the first highest node below it
+            entry = cut ? 0 : -1;
+            for (size_t i = 1; i < cut; i++)
+                if (nodes[i]->level > nodes[entry]->level) entry = (int) i;
+            max_level = cut ? nodes[entry]->level : -1;
+        }
+        epoch = ++snap_epochs_;
+        snap_state_.store(uint64_t(epoch) << 32 | uint32_t(cut), std::memory_order_release);
+    }
+    struct EndEpoch {
+        std::atomic<uint64_t> &state;
+        ~EndEpoch() { state.store(0, std::memory_order_release); }
+    } end_epoch{snap_state_};
+
+    os.write(hnsw_io::MAGIC, sizeof(hnsw_io::MAGIC));
+    hnsw_io::put<int32_t>(os, dim_);
+    hnsw_io::put<int32_t>(os, M_);
+    hnsw_io::put<int32_t>(os, ef_);
+    hnsw_io::put<uint64_t>(os, nodes.size());
+    hnsw_io::put<int32_t>(os, entry);
+    hnsw_io::put<int32_t>(os, max_level);
+
+    for (const Node *node: nodes) os.write(reinterpret_cast<const char *>(node->vec.data()), dim_ * sizeof(float));
+
+    LinkImage links;
+    std::vector<int> ids;
+    std::vector<float> ds;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const Node &node = *nodes[i];
+        std::unique_ptr<LinkImage> before;
+        {
+            // Captured by an insert already, or copied now and marked so inserts skip it
+            std::unique_lock nb_lock(node.node_mutex);
+            if (node.snap_epoch.load(std::memory_order_relaxed) == epoch) {
+                before = std::move(node.snap_before);
+            } else {
+                links.neighbors = node.neighbors;
+                links.dists = node.dists;
+                node.snap_before.reset();
+                node.snap_epoch.store(epoch, std::memory_order_relaxed);
+            }
+        }
+        // Links to nodes above the cut (still being linked at the cut, or found by this
+        // node's own insert among newer ones) are left out
+        const LinkImage &img = before ? *before : links;
+        hnsw_io::put<int32_t>(os, node.level);
+        hnsw_io::put<int32_t>(os, node.label);
+        for (int l = 0; l <= node.level; l++) {
+            ids.clear(), ds.clear();
+            for (size_t j = 0; j < img.neighbors[l].size(); j++)
+                if ((size_t) img.neighbors[l][j] < nodes.size())
+                    ids.push_back(img.neighbors[l][j]), ds.push_back(img.dists[l][j]);
+            hnsw_io::put<uint32_t>(os, (uint32_t) ids.size());
+            os.write(reinterpret_cast<const char *>(ids.data()), ids.size() * sizeof(int));
+            os.write(reinterpret_cast<const char *>(ds.data()), ds.size() * sizeof(float));
+        }
+    }
+    if (!os) throw std::runtime_error("HNSW::save: write failed");
+}
+
+inline size_t HNSW::snapshot(const std::string &path) const {
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    if (!f) throw std::runtime_error("Cannot write " + path);
+    save(f);
+    size_t bytes = (size_t) f.tellp();
+    if (!f.flush()) throw std::runtime_error("Cannot write " + path);
+    return bytes;
+}
+
+inline void HNSW::load(std::istream &is) {
+    std::unique_lock lock(global_lock_);
+    if (!nodes_.empty()) throw std::logic_error("HNSW::load requires an empty index");
+    char magic[sizeof(hnsw_io::MAGIC)];
+    hnsw_io::get_n(is, magic, sizeof(magic));
+    if (!std::equal(magic, magic + sizeof(magic), hnsw_io::MAGIC)) throw std::runtime_error("HNSW::load: not an index image");
+    if (hnsw_io::get<int32_t>(is) != dim_) throw std::runtime_error("HNSW::load: dimension mismatch");
+    M_ = hnsw_io::get<int32_t>(is);
+    ef_ = hnsw_io::get<int32_t>(is);
+    const size_t n = hnsw_io::get<uint64_t>(is);
+    const int entry = hnsw_io::get<int32_t>(is), max_level = hnsw_io::get<int32_t>(is);
+
+    std::vector<std::span<const float>> vecs(n);
+    std::vector<float> row(dim_);
+    for (size_t i = 0; i < n; i++) {
+        hnsw_io::get_n(is, row.data(), dim_);
+        vecs[i] = store_vector(row);
+    }
+
+    nodes_.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+        int level = hnsw_io::get<int32_t>(is), label = hnsw_io::get<int32_t>(is);
+        if (level < 0 || level > max_level) throw std::runtime_error("HNSW::load: bad node level");
+        auto node = std::make_unique<Node>(vecs[i], level, label);
+        for (int l = 0; l <= level; l++) {
+            uint32_t cnt = hnsw_io::get<uint32_t>(is);
+            node->neighbors[l].resize(cnt);
+            node->dists[l].resize(cnt);
+            hnsw_io::get_n(is, node->neighbors[l].data(), cnt);
+            hnsw_io::get_n(is, node->dists[l].data(), cnt);
+            for (int id: node->neighbors[l])
+                if (id < 0 || (size_t) id >= n) throw std::runtime_error("HNSW::load: link out of range");
+        }
+        nodes_.push_back(std::move(node));
+    }
+    entry_point_ = entry;
+    max_level_ = max_level;
 }
 
-#endif
\ No newline at end of file
+#endif
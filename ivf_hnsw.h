@@ -0,0 +1,175 @@
+#ifndef HNSW_IVF_HNSW_H
+#define HNSW_IVF_HNSW_H
+
+#include "hnsw.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+// ------------------------- IVF-HNSW -------------------------
+// Partitioned index for data too large for one graph: k-means centroids (coarse quantizer)
+// route every vector to its nearest centroid, and each of the P partitions is its own HNSW.
+// The centroids themselves sit in a small HNSW, so routing stays cheap for large P.
+// Partitions are built independently and in parallel, one per pool task, with no shared
+// lock between them. A query searches its nprobe nearest partitions and merges their top k.
+class IvfHnsw {
+public:
+    struct Params {
+        int partitions = 64;
+        int M = 16;                // per-partition HNSW
+        int ef_construction = 200;
+        int kmeans_iters = 10;
+        size_t train_size = 65536; // k-means sample (rows, evenly spaced over the input)
+        uint32_t seed = 42;
+        int search_threads = 0;    // search(): probes searched in parallel, 0 = the build's threads
+    };
+
+    IvfHnsw(int dim, const Params &pp) : dim_(dim), pp_(pp) {
+        if (pp.partitions < 1) throw std::invalid_argument("IvfHnsw: partitions must be >= 1");
+    }
+
+    // Build into an empty index; row i gets label i. get_row(i, buf) as for HNSW::insert_batch.
+    template<class GetRow>
+    void build(size_t n, GetRow &&get_row, int num_threads = 8) {
+        if (size() != 0) throw std::logic_error("IvfHnsw::build requires an empty index");
+        pool_ = std::make_shared<ThreadPool>(std::max(1, num_threads));
+        std::vector<std::vector<float>> bufs(pool_->size());
+
+        train(n, get_row);
+
+        // Route every row through the quantizer
+        std::vector<int> part_of(n);
+        pool_->parallel_for(0, n, [&](size_t i, int slot) {
+            part_of[i] = coarse_->search(get_row(i, bufs[slot]), 1, QUANT_EF)[0];
+        });
+        std::vector<std::vector<int>> members(centroids_.size() / dim_);
+        for (size_t i = 0; i < n; i++) members[part_of[i]].push_back((int) i);
+
+        // One task per partition, largest first so the tail is short
+        parts_.clear();
+        for (size_t p = 0; p < members.size(); p++)
+            parts_.push_back(std::make_unique<HNSW>(dim_, pp_.M, pp_.ef_construction));
+        std::vector<int> order(members.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](int a, int b) { return members[a].size() > members[b].size(); });
+        pool_->parallel_for(0, order.size(), [&](size_t o, int slot) {
+            const int p = order[o];
+            for (int i: members[p]) parts_[p]->insert(get_row(i, bufs[slot]), i);
+        });
+        size_ = n;
+    }
+
+    // (squared L2, label) of the k nearest over the nprobe partitions closest to the query.
+    // The partitions are searched on Params::search_threads threads of the build pool, or
+    // inline when that is 1, when there is a single probe, or when the caller is a pool
+    // worker. The pool runs one parallel_for at a time, so concurrent callers that fan out
+    // take turns; servers with their own query threads should set search_threads = 1.
+    std::vector<HNSW::Scored> search_scored(std::span<const float> query, int k, int nprobe,
+                                            int ef_search = -1) const {
+        if (!coarse_) return {};
+        nprobe = std::clamp(nprobe, 1, partitions());
+        auto probes = coarse_->search(query, nprobe, std::max(nprobe, QUANT_EF));
+
+        std::vector<std::vector<HNSW::Scored>> found(probes.size());
+        auto search_probe = [&](size_t i, int) { found[i] = parts_[probes[i]]->search_scored(query, k, ef_search); };
+        int width = std::min<int>(pp_.search_threads > 0 ? pp_.search_threads : pool_->size(), (int) probes.size());
+        if (width <= 1) {
+            for (size_t i = 0; i < probes.size(); i++) search_probe(i, 0);
+        } else {
+            pool_->parallel_for(0, probes.size(), search_probe, width);
+        }
+
+        std::vector<HNSW::Scored> res;
+        for (auto &f: found) res.insert(res.end(), f.begin(), f.end());
+        size_t top = std::min<size_t>(k, res.size());
+        std::partial_sort(res.begin(), res.begin() + top, res.end());
+        res.resize(top);
+        return res;
+    }
+
+    std::vector<int> search(std::span<const float> query, int k, int nprobe, int ef_search = -1) const {
+        std::vector<int> res;
+        for (auto &[d, label]: search_scored(query, k, nprobe, ef_search)) res.push_back(label);
+        return res;
+    }
+
+    int partitions() const { return (int) parts_.size(); }
+    size_t partition_size(int p) const { return parts_[p]->size(); }
+    size_t size() const { return size_; }
+
+    // Directed links of all partition graphs plus the quantizer
+    size_t link_count() const {
+        size_t links = coarse_ ? coarse_->link_count() : 0;
+        for (auto &p: parts_) links += p->link_count();
+        return links;
+    }
+
+private:
+    static constexpr int QUANT_EF = 32;// quantizer ef_search (at least nprobe)
+
+    int dim_;
+    Params pp_;
+    size_t size_ = 0;
+    std::vector<float> centroids_;   // row-major P x dim
+    std::unique_ptr<HNSW> coarse_;   // centroids, label = partition
+    std::vector<std::unique_ptr<HNSW>> parts_;
+    std::shared_ptr<ThreadPool> pool_;
+
+    // Lloyd's k-means on an evenly spaced sample, seeded with distinct random sample rows.
+    // A centroid that loses all its points is moved to a random sample row.
+    template<class GetRow>
+    void train(size_t n, GetRow &&get_row) {
+        const size_t s = std::min(n, std::max(pp_.train_size, (size_t) pp_.partitions));
+        const size_t P = std::min<size_t>(pp_.partitions, s);
+        std::vector<float> sample(s * dim_);
+        std::vector<float> buf;
+        for (size_t i = 0; i < s; i++) {
+            std::span<const float> row = get_row(i * n / s, buf);
+            std::copy(row.begin(), row.end(), sample.begin() + i * dim_);
+        }
+        auto sample_row = [&](size_t i) { return std::span<const float>(sample.data() + i * dim_, dim_); };
+
+        std::mt19937 rng(pp_.seed);
+        std::vector<size_t> pick(s);
+        std::iota(pick.begin(), pick.end(), 0);
+        std::shuffle(pick.begin(), pick.end(), rng);
+        centroids_.resize(P * dim_);
+        for (size_t c = 0; c < P; c++)
+            std::copy_n(sample.begin() + pick[c] * dim_, dim_, centroids_.begin() + c * dim_);
+
+        std::vector<int> assign(s);
+        for (int it = 0; it < pp_.kmeans_iters; it++) {
+            pool_->parallel_for(0, s, [&](size_t i, int) {
+                float best = std::numeric_limits<float>::max();
+                for (size_t c = 0; c < P; c++) {
+                    float d = l2_distance(sample_row(i), {centroids_.data() + c * dim_, (size_t) dim_});
+                    if (d < best) best = d, assign[i] = (int) c;
+                }
+            });
+            std::vector<double> sum(P * dim_, 0.0);
+            std::vector<size_t> cnt(P, 0);
+            for (size_t i = 0; i < s; i++) {
+                cnt[assign[i]]++;
+                for (int j = 0; j < dim_; j++) sum[assign[i] * dim_ + j] += sample[i * dim_ + j];
+            }
+            for (size_t c = 0; c < P; c++) {
+                if (cnt[c] == 0) {
+                    std::copy_n(sample.begin() + (rng() % s) * dim_, dim_, centroids_.begin() + c * dim_);
+                    continue;
+                }
+                for (int j = 0; j < dim_; j++) centroids_[c * dim_ + j] = float(sum[c * dim_ + j] / cnt[c]);
+            }
+        }
+
+        coarse_ = std::make_unique<HNSW>(dim_, pp_.M, pp_.ef_construction);
+        for (size_t c = 0; c < P; c++) coarse_->insert({centroids_.data() + c * dim_, (size_t) dim_}, (int) c);
+    }
+};
+
+#endif// HNSW_IVF_HNSW_H
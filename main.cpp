@@ -2,14 +2,31 @@
 #include <cassert>
 #include <chrono>
 #include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <queue>
 #include <random>
+#include <span>
+#include <thread>
 #include <vector>
 
 #include "cmd_args.h"
+#include "dataset_io.h"
+#include "disk_hnsw.h"
+#include "durable_hnsw.h"
+#include "exact_knn.h"
+#include "histogram.h"
 #include "hnsw.h"
+#include "ivf_hnsw.h"
+#include "server.h"
+#include "sharded_hnsw.h"
+#include "streaming_hnsw.h"
+#include "synthetic_data.h"
 
 // ------------------------- Search -------------------------
 //------------------------- Exact KNN -------------------------
@@ -28,6 +45,26 @@ std::vector<int> exact_knn_L2(const std::vector<std::vector<float>> &data, const
     return res;
 }
 
+//------------------------- Exact Range (L2) -------------------------
+// All points within L2 distance `radius`, closest first, at most max_results.
+std::vector<int> exact_range_L2(const std::vector<std::vector<float>> &data, const std::vector<float> &query,
+                                float radius, int max_results) {
+    float radius2 = radius * radius;
+    std::vector<std::pair<float, int>> dist;
+    for (int i = 0; i < (int) data.size(); i++) {
+        float d = l2_distance(query, data[i]);
+        if (d <= radius2) dist.emplace_back(d, i);
+    }
+
+    std::sort(dist.begin(), dist.end());
+    if (dist.size() > (size_t) max_results) dist.resize(max_results);
+
+    std::vector<int> res;
+    for (auto &[d, id]: dist)
+        res.push_back(id);
+    return res;
+}
+
 // ------------------------- Orthonormal Centers -------------------------
 std::vector<std::vector<float>> generate_well_separated_centers(int dim, int nclusters, float min_dist) {
     std::mt19937 rng(42);
@@ -58,39 +95,40 @@ std::vector<float> sample_near(const std::vector<float> &center, float sigma, st
     return v;
 }
 
-// ------------------------- Test UT -------------------------
-
-void test_hnsw_vs_exact_knn(const CmdArgs &p) {
-    std::cout << "[UT] HNSW vs Exact KNN (L2)\n";
-
-    HNSW index(p.dim, p.M, p.efc);
-    std::mt19937 rng(p.seed);
-
-    // --- 1. DATA GENERATION ---
-    auto centers = generate_well_separated_centers(
-            p.dim, p.clusters, p.center_dist);
-
-    std::vector<std::vector<float>> dataset;
-    dataset.reserve(p.clusters * p.pts);
-
-    for (int c = 0; c < p.clusters; c++) {
-        for (int i = 0; i < p.pts; i++) {
-            dataset.push_back(sample_near(centers[c], p.sigma, rng));
-        }
-    }
-
-    // --- 2. INDEX BUILD (single vs multi-thread) ---
+// ------------------------- Index build -------------------------
+// get_row(i, buf) returns row i, either from existing storage or decoded into buf
+template<class GetRow>
+double build_index(HNSW &index, size_t n, GetRow &&get_row, const CmdArgs &p) {
+    LatencyHistogram insert_latency;// single-threaded build only
+    index.set_prune(p.alpha, p.keep_pruned);
     auto t0_build = std::chrono::high_resolution_clock::now();
 
-    if (p.threads <= 1) {
+    if (p.bulk_build) {
+        std::cout << "Starting NN-Descent bulk build with "
+                  << p.threads << " threads...\n";
+        index.build(n, get_row, p.threads);
+    } else if (p.threads <= 1) {
         std::cout << "Starting single-threaded index build...\n";
-        for (const auto &v: dataset) {
-            index.insert(v);
+        std::vector<float> buf;
+        for (size_t i = 0; i < n; i++) {
+            std::span<const float> v = get_row(i, buf);
+            auto t0 = std::chrono::high_resolution_clock::now();
+            index.insert(v, (int) i);
+            insert_latency.record(std::chrono::high_resolution_clock::now() - t0);
+        }
+    } else if (p.insert_batch > 0) {
+        std::cout << "Starting parallel index build with "
+                  << p.threads << " threads in batches of " << p.insert_batch << "...\n";
+        for (size_t b0 = 0; b0 < n; b0 += p.insert_batch) {
+            size_t cnt = std::min<size_t>(p.insert_batch, n - b0);
+            index.insert_batch(cnt, [&](size_t i, std::vector<float> &buf) -> std::span<const float> {
+                return get_row(b0 + i, buf);
+            }, p.threads);
         }
     } else {
         std::cout << "Starting parallel index build with "
                   << p.threads << " threads...\n";
-        index.insert_batch(dataset, p.threads);
+        index.insert_batch(n, get_row, p.threads);
     }
 
     auto t1_build = std::chrono::high_resolution_clock::now();
@@ -99,66 +137,829 @@ void test_hnsw_vs_exact_knn(const CmdArgs &p) {
 
     std::cout << "[TIME] Total index insert: "
               << build_time << " sec\n";
+    if (index.insert_distance_evals())
+        std::cout << "Avg distance computations per insert: "
+                  << (double) index.insert_distance_evals() / n << "\n";
+    if (insert_latency.count()) insert_latency.print("insert");
+    return build_time;
+}
 
-    // --- 3. QUERY / SEARCH ---
-    int total_queries = 0;
-    int top1_correct = 0;
-    float avg_recall = 0.0f;
-    double search_time_total = 0.0;
+double build_index(HNSW &index, const std::vector<std::vector<float>> &dataset, const CmdArgs &p) {
+    return build_index(index, dataset.size(), [&](size_t i, std::vector<float> &) -> std::span<const float> {
+        return dataset[i];
+    }, p);
+}
 
-    // Pre-generate queries
+// ------------------------- KNN workload -------------------------
+// Base vectors, queries and exact ground truth for UT1 and the sweep: either the synthetic
+// clusters, or TEXMEX files from --base / --query / --gt. A base file stays memory-mapped
+// and is streamed into the index row by row.
+struct KnnWorkload {
+    int dim = 0;
+    size_t n = 0;
+    std::vector<float> base;// synthetic base, row-major n x dim (empty for --base)
+    std::unique_ptr<VecFile> base_file;
     std::vector<std::vector<float>> queries;
-    queries.reserve(p.clusters * p.queries);
+    std::vector<std::vector<int>> exact;// ground truth, closest first
 
-    for (int c = 0; c < p.clusters; c++) {
-        for (int q = 0; q < p.queries; q++) {
-            queries.push_back(sample_near(centers[c], p.sigma, rng));
+    size_t size() const { return n; }
+
+    // Row i: a view of the synthetic base or of an fvecs mapping; bvecs rows are decoded into buf
+    std::span<const float> row(size_t i, std::vector<float> &buf) const {
+        if (base_file) return base_file->row(i, buf);
+        return {base.data() + i * dim, size_t(dim)};
+    }
+};
+
+// Synthetic base and queries of the cluster model (see synthetic_data.h): base in
+// stream 0, queries in stream 1, both generated in parallel from --seed
+std::vector<std::vector<float>> synthetic_centers(const CmdArgs &p) {
+    return generate_well_separated_centers(p.dim, p.clusters, p.center_dist);
+}
+
+ClusterSpec synthetic_spec(const CmdArgs &p, const std::vector<std::vector<float>> &centers, bool queries) {
+    return {&centers, (size_t) (queries ? p.queries : p.pts), p.sigma, (uint64_t) p.seed, queries ? 1u : 0u};
+}
+
+KnnWorkload load_knn_workload(const CmdArgs &p, int gt_k) {
+    KnnWorkload w;
+
+    if (p.base.empty()) {
+        auto centers = synthetic_centers(p);
+
+        auto t0 = std::chrono::high_resolution_clock::now();
+        w.dim = p.dim;
+        w.n = (size_t) p.clusters * p.pts;
+        w.base.resize(w.n * w.dim);
+        generate_clusters(synthetic_spec(p, centers, false), 0, w.n, w.base.data(), p.threads);
+
+        size_t nq = (size_t) p.clusters * p.queries;
+        std::vector<float> qbuf(nq * w.dim);
+        generate_clusters(synthetic_spec(p, centers, true), 0, nq, qbuf.data(), p.threads);
+        for (size_t i = 0; i < nq; i++)
+            w.queries.emplace_back(qbuf.begin() + i * w.dim, qbuf.begin() + (i + 1) * w.dim);
+        auto t1 = std::chrono::high_resolution_clock::now();
+        std::cout << "[TIME] Data generation: "
+                  << std::chrono::duration<double>(t1 - t0).count() << " sec\n";
+    } else {
+        if (p.query.empty()) {
+            std::cerr << "--base requires --query\n";
+            std::exit(1);
+        }
+        w.base_file = std::make_unique<VecFile>(p.base);
+        w.dim = w.base_file->dim();
+        w.n = w.base_file->size();
+
+        VecFile qf(p.query);
+        if (qf.dim() != w.dim) {
+            std::cerr << "Query dimension " << qf.dim() << " != base dimension " << w.dim << "\n";
+            std::exit(1);
+        }
+        size_t nq = p.nq > 0 ? std::min<size_t>(p.nq, qf.size()) : qf.size();
+        w.queries.resize(nq);
+        for (size_t i = 0; i < nq; i++) qf.read(i, w.queries[i]);
+        std::cout << "Loaded " << w.base_file->size() << " base vectors (dim " << w.dim
+                  << ", mmap'd) and " << nq << " queries\n";
+    }
+
+    if (gt_k <= 0) return w;// no ground truth wanted (serving)
+
+    if (!p.gt.empty()) {
+        VecFile gf(p.gt);
+        if (gf.size() < w.queries.size() || gf.dim() < gt_k) {
+            std::cerr << "Ground truth " << p.gt << " has " << gf.size() << " x " << gf.dim()
+                      << " ids, need " << w.queries.size() << " x " << gt_k << "\n";
+            std::exit(1);
+        }
+        w.exact.resize(w.queries.size());
+        for (size_t i = 0; i < w.queries.size(); i++) {
+            gf.read(i, w.exact[i]);
+            w.exact[i].resize(gt_k);
+        }
+        return w;
+    }
+
+    // Exact KNN (not timed): blocked multi-threaded scan, cached per dataset + queries + k
+    auto get_row = [&](size_t i, std::vector<float> &buf) -> std::span<const float> {
+        return w.row(i, buf);
+    };
+
+    std::string cache;
+    if (!p.gt_cache.empty()) {
+        uint64_t h = fingerprint_rows(w.size(), get_row);
+        h = fingerprint_rows(w.queries.size(), [&](size_t i, std::vector<float> &) -> std::span<const float> {
+            return w.queries[i];
+        }, h);
+        char name[64];
+        std::snprintf(name, sizeof(name), "/gt_%016llx_k%d.ivecs", (unsigned long long) h, gt_k);
+        cache = p.gt_cache + name;
+
+        if (FILE *f = std::fopen(cache.c_str(), "rb")) {
+            std::fclose(f);
+            VecFile gf(cache);
+            w.exact.resize(gf.size());
+            for (size_t i = 0; i < gf.size(); i++) gf.read(i, w.exact[i]);
+            std::cout << "Ground truth (k=" << gt_k << ") loaded from cache " << cache << "\n";
+            return w;
         }
     }
 
-    for (const auto &query_vec: queries) {
-        // Exact KNN (not timed)
-        auto exact = exact_knn_L2(dataset, query_vec, p.k);
+    auto t0 = std::chrono::high_resolution_clock::now();
+    w.exact = exact_knn_blocked(w.size(), w.dim, get_row, w.queries, gt_k);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    std::cout << "[TIME] Ground truth (k=" << gt_k << "): "
+              << std::chrono::duration<double>(t1 - t0).count() << " sec\n";
+
+    if (!cache.empty()) {
+        write_ivecs(cache, w.exact);
+        std::cout << "Ground truth cached to " << cache << "\n";
+    }
+    return w;
+}
+
+double build_index(HNSW &index, const KnnWorkload &w, const CmdArgs &p) {
+    return build_index(index, w.size(), [&](size_t i, std::vector<float> &buf) -> std::span<const float> {
+        return w.row(i, buf);
+    }, p);
+}
+
+// ------------------------- Synthetic data to fvecs -------------------------
+// --gen PREFIX: stream the synthetic base / queries to PREFIX_base.fvecs / PREFIX_query.fvecs
+void write_synthetic_fvecs(const CmdArgs &p) {
+    auto centers = synthetic_centers(p);
+    auto t0 = std::chrono::high_resolution_clock::now();
+    write_clusters_fvecs(p.gen + "_base.fvecs", synthetic_spec(p, centers, false), (size_t) p.clusters * p.pts, p.threads);
+    write_clusters_fvecs(p.gen + "_query.fvecs", synthetic_spec(p, centers, true), (size_t) p.clusters * p.queries, p.threads);
+    auto t1 = std::chrono::high_resolution_clock::now();
+    std::cout << "[GEN] Wrote " << (size_t) p.clusters * p.pts << " base / " << (size_t) p.clusters * p.queries
+              << " query vectors to " << p.gen << "_{base,query}.fvecs in "
+              << std::chrono::duration<double>(t1 - t0).count() << " sec\n";
+}
+
+// ------------------------- Search evaluation -------------------------
+struct SearchEval {
+    float top1 = 0.0f;
+    float recall = 0.0f;
+    double avg_time = 0.0;
+    double avg_dist_evals = 0.0;
+    LatencyHistogram latency;
+    std::vector<SearchStats> stats;// per query, HNSW_SEARCH_STATS builds only
+};
+
+// Default --patience for --efs auto: a few expansions per requested neighbor
+int auto_patience(int k) {
+    return std::max(16, 4 * k);
+}
+
+// search(q, stats) returns the approximate neighbors of queries[q]
+template<class Search>
+SearchEval evaluate_search(Search &&search, const std::vector<std::vector<float>> &queries,
+                           const std::vector<std::vector<int>> &exact, int k) {
+    SearchEval e;
+    double search_time_total = 0.0;
+    size_t dist_evals = 0;
+    int top1_correct = 0;
 
+    for (size_t q = 0; q < queries.size(); q++) {
         // Approximate search (timed)
+        size_t evals0 = HNSW::thread_distance_evals();
         auto t0 = std::chrono::high_resolution_clock::now();
-        auto approx = index.search(query_vec, p.k, p.efs);
+        SearchStats stats;
+        std::vector<int> approx = search(q, stats);
         auto t1 = std::chrono::high_resolution_clock::now();
+        dist_evals += HNSW::thread_distance_evals() - evals0;
+        e.latency.record(t1 - t0);
+#ifdef HNSW_SEARCH_STATS
+        e.stats.push_back(std::move(stats));
+#endif
 
         search_time_total +=
                 std::chrono::duration<double>(t1 - t0).count();
 
         int hit = 0;
         for (int id: approx) {
-            if (std::find(exact.begin(), exact.end(), id) != exact.end())
+            if (std::find(exact[q].begin(), exact[q].end(), id) != exact[q].end())
                 hit++;
         }
-        avg_recall += float(hit) / p.k;
+        e.recall += float(hit) / k;
 
-        if (!approx.empty() && !exact.empty() && approx[0] == exact[0])
+        if (!approx.empty() && !exact[q].empty() && approx[0] == exact[q][0])
             top1_correct++;
-
-        total_queries++;
     }
 
-    avg_recall /= total_queries;
-    double avg_search_time = search_time_total / total_queries;
+    int total_queries = queries.size();
+    e.top1 = float(top1_correct) / total_queries;
+    e.recall /= total_queries;
+    e.avg_time = search_time_total / total_queries;
+    e.avg_dist_evals = double(dist_evals) / total_queries;
+    return e;
+}
+
+SearchEval evaluate_search(const HNSW &index, const std::vector<std::vector<float>> &queries,
+                           const std::vector<std::vector<int>> &exact, int k, int ef, int patience) {
+    return evaluate_search([&](size_t q, SearchStats &stats) {
+        return index.search(queries[q], k, ef, patience, &stats);
+    }, queries, exact, k);
+}
+
+// Nearest-rank percentile, q in [0, 1]
+double percentile(std::vector<double> v, double q) {
+    if (v.empty()) return 0.0;
+    size_t idx = std::min(v.size() - 1, (size_t) std::ceil(q * v.size()) - (q > 0.0));
+    std::nth_element(v.begin(), v.begin() + idx, v.end());
+    return v[idx];
+}
+
+void print_search_stats(const std::vector<SearchStats> &stats) {
+    if (stats.empty()) return;
+
+    auto row = [&](const char *name, auto field) {
+        std::vector<double> v;
+        double sum = 0.0;
+        for (const auto &st: stats) {
+            v.push_back(field(st));
+            sum += v.back();
+        }
+        std::cout << "  " << std::left << std::setw(22) << name << std::right
+                  << std::setw(12) << sum / v.size()
+                  << std::setw(12) << percentile(v, 0.50)
+                  << std::setw(12) << percentile(v, 0.99) << "\n";
+    };
+
+    std::cout << "Per-query search stats:\n  " << std::left << std::setw(22) << "" << std::right
+              << std::setw(12) << "mean" << std::setw(12) << "p50" << std::setw(12) << "p99" << "\n";
+    row("dist evals (total)", [](const SearchStats &st) { return (double) st.total_dist_evals(); });
+    row("dist evals (layer 0)", [](const SearchStats &st) { return (double) st.dist_evals[0]; });
+    row("dist evals (upper)", [](const SearchStats &st) { return (double) (st.total_dist_evals() - st.dist_evals[0]); });
+    row("nodes expanded", [](const SearchStats &st) { return (double) st.nodes_expanded; });
+    row("heap pushes", [](const SearchStats &st) { return (double) st.heap_pushes; });
+    row("visited resets", [](const SearchStats &st) { return (double) st.visited_resets; });
+    row("wall time (us)", [](const SearchStats &st) { return st.wall_time * 1e6; });
+}
 
-    // --- RESULTS ---
-    std::cout << "Top-1 accuracy: "
-              << float(top1_correct) / total_queries << "\n";
-    std::cout << "Recall@" << p.k << ": " << avg_recall << "\n";
+void print_search_eval(const SearchEval &e, int k) {
+    std::cout << "Top-1 accuracy: " << e.top1 << "\n";
+    std::cout << "Recall@" << k << ": " << e.recall << "\n";
+    std::cout << "Avg distance computations per query: " << e.avg_dist_evals << "\n";
     std::cout << "[TIME] Avg search per query: "
-              << avg_search_time << " sec\n";
+              << e.avg_time << " sec\n";
+    e.latency.print("search");
+    print_search_stats(e.stats);
+}
+
+// ------------------------- HNSW vs flat Vamana -------------------------
+// --vamana: build a flat Vamana graph on the same data (R = 2M, like HNSW layer 0, L = efc)
+// and print both indexes side by side at the same efs
+void compare_with_vamana(const KnnWorkload &w, const HNSW &index, double build_time,
+                         const SearchEval &eval, const CmdArgs &p) {
+    HNSW::VamanaParams vp;
+    vp.R = 2 * p.M;
+    vp.L = p.efc;
+    vp.alpha = p.vamana_alpha;
+
+    HNSW flat(w.dim, p.M, p.efc);
+    std::cout << "Starting Vamana build (R " << vp.R << ", L " << vp.L << ", alpha " << vp.alpha
+              << ") with " << p.threads << " threads...\n";
+    auto t0 = std::chrono::high_resolution_clock::now();
+    flat.build_vamana(w.size(), [&](size_t i, std::vector<float> &buf) -> std::span<const float> {
+        return w.row(i, buf);
+    }, vp, p.threads);
+    double flat_time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+    auto flat_eval = evaluate_search(flat, w.queries, w.exact, p.k, p.efs, 0);
+
+    std::cout << "\n[UT1] HNSW vs Vamana (efs " << p.efs << ")\n"
+              << std::left << std::setw(8) << "index" << std::right
+              << std::setw(10) << "build_s" << std::setw(10) << "links"
+              << std::setw(10) << "recall" << std::setw(10) << "top1"
+              << std::setw(10) << "QPS" << std::setw(12) << "dist/query" << "\n";
+    auto row = [&](const char *name, double bt, size_t links, const SearchEval &e) {
+        std::cout << std::left << std::setw(8) << name << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(10) << bt
+                  << std::setw(10) << links
+                  << std::setprecision(4) << std::setw(10) << e.recall << std::setw(10) << e.top1
+                  << std::setprecision(0) << std::setw(10) << (e.avg_time > 0 ? 1.0 / e.avg_time : 0.0)
+                  << std::setprecision(1) << std::setw(12) << e.avg_dist_evals << "\n"
+                  << std::defaultfloat << std::setprecision(6);
+    };
+    row("hnsw", build_time, index.link_count(), eval);
+    row("vamana", flat_time, flat.link_count(), flat_eval);
+}
+
+// ------------------------- HNSW vs IVF-HNSW -------------------------
+// --ivf P: partition the same data into P k-means cells with one HNSW each (same M / efc),
+// then search it with nprobe = 1, 2, 4, ... up to --nprobe next to the monolithic index
+void compare_with_ivf(const KnnWorkload &w, const HNSW &index, double build_time,
+                      const SearchEval &eval, const CmdArgs &p) {
+    IvfHnsw::Params pp;
+    pp.partitions = p.ivf;
+    pp.M = p.M;
+    pp.ef_construction = p.efc;
+    pp.seed = p.seed;
+
+    IvfHnsw ivf(w.dim, pp);
+    std::cout << "Starting IVF-HNSW build (" << pp.partitions << " partitions) with "
+              << p.threads << " threads...\n";
+    auto t0 = std::chrono::high_resolution_clock::now();
+    ivf.build(w.size(), [&](size_t i, std::vector<float> &buf) -> std::span<const float> {
+        return w.row(i, buf);
+    }, p.threads);
+    double ivf_time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+
+    size_t largest = 0;
+    for (int c = 0; c < ivf.partitions(); c++) largest = std::max(largest, ivf.partition_size(c));
+    std::cout << "Partition sizes: mean " << w.size() / ivf.partitions() << ", max " << largest << "\n";
+
+    std::cout << "\n[UT1] HNSW vs IVF-HNSW (efs " << p.efs << ")\n"
+              << std::left << std::setw(8) << "index" << std::right
+              << std::setw(8) << "nprobe" << std::setw(10) << "build_s" << std::setw(10) << "links"
+              << std::setw(10) << "recall" << std::setw(10) << "top1" << std::setw(10) << "QPS"
+              << std::setw(10) << "p99_us" << "\n";
+    auto row = [&](const char *name, const std::string &nprobe, double bt, size_t links, const SearchEval &e) {
+        std::cout << std::left << std::setw(8) << name << std::right << std::setw(8) << nprobe << std::fixed
+                  << std::setprecision(2) << std::setw(10) << bt
+                  << std::setw(10) << links
+                  << std::setprecision(4) << std::setw(10) << e.recall << std::setw(10) << e.top1
+                  << std::setprecision(0) << std::setw(10) << (e.avg_time > 0 ? 1.0 / e.avg_time : 0.0)
+                  << std::setprecision(1) << std::setw(10) << e.latency.percentile_ns(0.99) / 1e3 << "\n"
+                  << std::defaultfloat << std::setprecision(6);
+    };
+    row("hnsw", "-", build_time, index.link_count(), eval);
+    for (int nprobe = 1;; nprobe = std::min(2 * nprobe, p.nprobe)) {
+        auto e = evaluate_search([&](size_t q, SearchStats &) {
+            return ivf.search(w.queries[q], p.k, nprobe, p.efs);
+        }, w.queries, w.exact, p.k);
+        row("ivf", std::to_string(nprobe), ivf_time, ivf.link_count(), e);
+        if (nprobe >= std::min(p.nprobe, ivf.partitions())) break;
+    }
+}
+
+// ------------------------- HNSW vs sharded HNSW -------------------------
+// --shards S: hash-partition the same data over 1, 2, 4, ... S independent HNSW shards (same
+// M / efc), built with one task per shard on --threads workers. Per-query QPS fans each query
+// out to all shards; batch QPS runs whole queries in parallel instead.
+void compare_with_shards(const KnnWorkload &w, const HNSW &index, double build_time,
+                         const SearchEval &eval, const CmdArgs &p) {
+    std::cout << "\n[UT1] HNSW vs sharded HNSW (efs " << p.efs << ", " << p.threads << " threads)\n"
+              << std::left << std::setw(8) << "index" << std::right
+              << std::setw(8) << "shards" << std::setw(10) << "build_s" << std::setw(10) << "links"
+              << std::setw(10) << "recall" << std::setw(10) << "QPS" << std::setw(12) << "batch_QPS" << "\n";
+    auto row = [&](const char *name, int shards, double bt, size_t links, const SearchEval &e, double batch_qps) {
+        std::cout << std::left << std::setw(8) << name << std::right << std::setw(8) << shards << std::fixed
+                  << std::setprecision(2) << std::setw(10) << bt
+                  << std::setw(10) << links
+                  << std::setprecision(4) << std::setw(10) << e.recall
+                  << std::setprecision(0) << std::setw(10) << (e.avg_time > 0 ? 1.0 / e.avg_time : 0.0)
+                  << std::setw(12) << batch_qps << "\n"
+                  << std::defaultfloat << std::setprecision(6);
+    };
+    auto batch_qps = [&](auto &idx) {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        idx.search_batch(w.queries, p.k, p.efs, p.threads);
+        return w.queries.size() / std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+    };
+    row("hnsw", 1, build_time, index.link_count(), eval, batch_qps(index));
+
+    for (int shards = 1;; shards = std::min(2 * shards, p.shards)) {
+        ShardedHNSW::Params sp;
+        sp.shards = shards;
+        sp.M = p.M;
+        sp.ef_construction = p.efc;
+        sp.search_threads = p.threads;
+        ShardedHNSW sharded(w.dim, sp);
+
+        auto t0 = std::chrono::high_resolution_clock::now();
+        sharded.insert_batch(w.size(), [&](size_t i, std::vector<float> &buf) -> std::span<const float> {
+            return w.row(i, buf);
+        }, p.threads);
+        double bt = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+
+        auto e = evaluate_search([&](size_t q, SearchStats &) {
+            return sharded.search(w.queries[q], p.k, p.efs);
+        }, w.queries, w.exact, p.k);
+        row("sharded", shards, bt, sharded.link_count(), e, batch_qps(sharded));
+        if (shards >= p.shards) break;
+    }
+}
+
+// ------------------------- Streaming ingest -------------------------
+// --stream P: P producer threads push the base through enqueue_insert() while the indexer
+// builds the graph on --threads workers. Every 64th producer immediately searches for the
+// vector it just enqueued (read-your-writes through the pending scan).
+void compare_with_streaming(const KnnWorkload &w, double build_time, const CmdArgs &p) {
+    StreamingHNSW::Params sp;
+    sp.M = p.M;
+    sp.ef_construction = p.efc;
+    sp.threads = p.threads;
+    StreamingHNSW stream(w.dim, sp);
+
+    std::vector<LatencyHistogram> enqueue_lat(p.stream);
+    std::vector<size_t> checked(p.stream, 0), visible(p.stream, 0);
+    std::vector<std::thread> producers;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (int t = 0; t < p.stream; t++) {
+        producers.emplace_back([&, t]() {
+            std::vector<float> buf;
+            for (size_t i = t; i < w.size(); i += p.stream) {
+                auto row = w.row(i, buf);
+                auto e0 = std::chrono::steady_clock::now();
+                stream.enqueue_insert((int) i, row);
+                enqueue_lat[t].record(std::chrono::steady_clock::now() - e0);
+                if (i % 64 == 0) {
+                    auto found = stream.search(row, p.k, p.efs);
+                    checked[t]++;
+                    visible[t] += std::find(found.begin(), found.end(), (int) i) != found.end();
+                }
+            }
+        });
+    }
+    for (auto &th: producers) th.join();
+    double enqueue_sec = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+    size_t backlog = stream.pending();
+    stream.flush();
+    double total_sec = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+
+    LatencyHistogram enq;
+    size_t n_checked = 0, n_visible = 0;
+    for (int t = 0; t < p.stream; t++) {
+        enq.merge(enqueue_lat[t]);
+        n_checked += checked[t];
+        n_visible += visible[t];
+    }
+
+    std::cout << "\n[UT1] Streaming ingest (" << p.stream << " producers, " << p.threads << " indexer threads)\n"
+              << "[TIME] Enqueue all: " << enqueue_sec << " sec (" << w.size() / enqueue_sec
+              << " vectors/sec), backlog at end " << backlog << "\n"
+              << "[TIME] Until indexed: " << total_sec << " sec (" << w.size() / total_sec
+              << " vectors/sec; blocking build " << build_time << " sec)\n"
+              << "Read-your-writes: " << n_visible << "/" << n_checked << " just-enqueued vectors found\n";
+    enq.print("enqueue_insert");
+    stream.index_lag().print("visibility lag (enqueue to indexed)");
+    print_search_eval(evaluate_search([&](size_t q, SearchStats &) {
+        return stream.search(w.queries[q], p.k, p.efs);
+    }, w.queries, w.exact, p.k), p.k);
+}
+
+// ------------------------- Write-ahead log -------------------------
+// --wal DIR: the base inserted by --threads writer threads into a plain HNSW and into a
+// DurableHNSW in DIR (every insert durable before it returns), then 1% removes and 1% updates,
+// then two recoveries: from the log (plus any --snapshot-every checkpoint), and from a fresh
+// snapshot alone
+void compare_with_wal(const KnnWorkload &w, const CmdArgs &p) {
+    auto run_writers = [&](auto &&insert) {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        std::vector<std::thread> writers;
+        for (int t = 0; t < p.threads; t++) {
+            writers.emplace_back([&, t]() {
+                std::vector<float> buf;
+                for (size_t i = t; i < w.size(); i += p.threads) insert((int) i, w.row(i, buf));
+            });
+        }
+        for (auto &th: writers) th.join();
+        return std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+    };
+    auto recall = [&](auto &idx) {
+        return evaluate_search([&](size_t q, SearchStats &) {
+            return idx.search(w.queries[q], p.k, p.efs);
+        }, w.queries, w.exact, p.k).recall;
+    };
+
+    HNSW mem(w.dim, p.M, p.efc);
+    double mem_sec = run_writers([&](int label, std::span<const float> v) { mem.insert(v, label); });
+
+    // Start from an empty log: remove only what DurableHNSW writes
+    std::filesystem::create_directories(p.wal);
+    for (auto &e: std::filesystem::directory_iterator(p.wal)) {
+        std::string name = e.path().filename().string();
+        if (name.rfind("wal.", 0) == 0 || name.rfind("snapshot", 0) == 0) std::filesystem::remove(e.path());
+    }
+
+    DurableHNSW::Params dp;
+    dp.M = p.M;
+    dp.ef_construction = p.efc;
+    dp.threads = p.threads;
+    dp.snapshot_every = (size_t) p.snapshot_every;
+
+    size_t removed = 0, updated = 0;
+    double wal_sec, mut_sec;
+    size_t records, commits, snapshots;
+    {
+        DurableHNSW durable(p.wal, w.dim, dp);
+        wal_sec = run_writers([&](int label, std::span<const float> v) { durable.insert(label, v); });
+
+        auto t0 = std::chrono::high_resolution_clock::now();
+        std::vector<float> buf;
+        for (size_t i = 0; i + 1 < w.size(); i += 100) {
+            removed += durable.remove((int) i);
+            updated += durable.update((int) i + 1, w.row(i + 1, buf));
+        }
+        mut_sec = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+        records = durable.records();
+        commits = durable.commits();
+        snapshots = durable.snapshots();
+    }
+
+    std::cout << "\n[UT1] Write-ahead log (" << p.threads << " writer threads, " << p.wal << ")\n"
+              << "[TIME] In-memory inserts: " << mem_sec << " sec (" << w.size() / mem_sec << " inserts/sec)\n"
+              << "[TIME] Durable inserts:   " << wal_sec << " sec (" << w.size() / wal_sec << " inserts/sec, "
+              << std::fixed << std::setprecision(1) << 100.0 * (wal_sec / mem_sec - 1.0) << "% overhead)\n"
+              << std::defaultfloat << std::setprecision(6)
+              << "[TIME] " << removed << " removes + " << updated << " updates: " << mut_sec << " sec\n"
+              << "Records: " << records << " in " << commits << " group commits ("
+              << (commits ? double(records) / commits : 0.0) << " per fsync), " << snapshots << " snapshots\n";
+
+    auto report = [&](const char *what, const DurableHNSW &d) {
+        auto &r = d.recovery();
+        std::cout << "[TIME] Recovery " << what << ": " << r.snapshot_sec + r.replay_sec << " sec (snapshot "
+                  << (r.snapshot ? std::to_string(r.snapshot_slots) + " slots, " : std::string("none, "))
+                  << r.snapshot_sec << " sec; " << r.wal_records << " WAL records, " << r.replayed_inserts
+                  << " graph inserts, " << r.replay_sec << " sec)\n"
+                  << "  live labels " << d.size() << " (expected " << w.size() - removed << "), recall@" << p.k
+                  << " " << recall(d) << " (in-memory " << recall(mem) << ")\n";
+    };
+    {
+        DurableHNSW durable(p.wal, w.dim, dp);
+        report("from log", durable);
+        durable.snapshot();
+    }
+    DurableHNSW durable(p.wal, w.dim, dp);
+    report("from snapshot", durable);
+}
+
+// ------------------------- Live snapshot -------------------------
+// --snapshot PATH: half the base is indexed, then the other half goes in through one
+// insert_batch() while a search thread loops over the queries. Once a third of the second
+// half is in, HNSW::snapshot() writes PATH concurrently. Insert and search rates are compared
+// inside and outside the snapshot window, and the image is loaded back.
+void compare_with_snapshot(const KnnWorkload &w, const CmdArgs &p) {
+    using clock = std::chrono::steady_clock;
+    auto get_row = [&](size_t i, std::vector<float> &buf) -> std::span<const float> { return w.row(i, buf); };
+    const size_t half = w.size() / 2;
+
+    HNSW index(w.dim, p.M, p.efc);
+    index.set_prune(p.alpha, p.keep_pruned);
+    index.insert_batch(half, get_row, p.threads);
+
+    std::atomic<bool> done{false};
+    std::atomic<size_t> searches{0};
+    clock::time_point snap_start, snap_end;
+    size_t bytes = 0, cut = 0;
+
+    auto t0 = clock::now();
+    std::thread inserter([&]() {
+        index.insert_batch(w.size() - half, [&](size_t i, std::vector<float> &buf) {
+            return w.row(half + i, buf);
+        }, p.threads);
+        done = true;
+    });
+    std::thread searcher([&]() {
+        for (size_t q = 0; !done; q = (q + 1) % w.queries.size()) {
+            index.search(w.queries[q], p.k, p.efs);
+            ++searches;
+        }
+    });
+    std::thread snapshotter([&]() {
+        while (!done && index.size() < half + (w.size() - half) / 3) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        cut = index.size();
+        snap_start = clock::now();
+        bytes = index.snapshot(p.snapshot);
+        snap_end = clock::now();
+    });
+
+    // (time, nodes, searches) every 10 ms
+    struct Sample {
+        clock::time_point t;
+        size_t nodes, searches;
+    };
+    std::vector<Sample> samples;
+    while (!done) {
+        samples.push_back({clock::now(), index.size(), searches.load()});
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    inserter.join();
+    searcher.join();
+    snapshotter.join();
+    samples.push_back({clock::now(), index.size(), searches.load()});
+
+    // Rates over the sample intervals inside vs outside [snap_start, snap_end]
+    double in_sec = 0, out_sec = 0;
+    size_t in_nodes = 0, out_nodes = 0, in_q = 0, out_q = 0;
+    for (size_t i = 1; i < samples.size(); i++) {
+        double dt = std::chrono::duration<double>(samples[i].t - samples[i - 1].t).count();
+        size_t dn = samples[i].nodes - samples[i - 1].nodes, dq = samples[i].searches - samples[i - 1].searches;
+        bool inside = samples[i].t > snap_start && samples[i - 1].t < snap_end;
+        (inside ? in_sec : out_sec) += dt;
+        (inside ? in_nodes : out_nodes) += dn;
+        (inside ? in_q : out_q) += dq;
+    }
+    double total = std::chrono::duration<double>(samples.back().t - t0).count();
+    double snap_sec = std::chrono::duration<double>(snap_end - snap_start).count();
+
+    std::cout << "\n[UT1] Live snapshot (" << p.threads << " insert threads + 1 search thread, " << p.snapshot << ")\n"
+              << "[TIME] Second half inserted in " << total << " sec, snapshot at " << cut << " nodes took "
+              << snap_sec << " sec (" << bytes / 1e6 << " MB, " << bytes / 1e6 / snap_sec << " MB/s)\n"
+              << std::fixed << std::setprecision(0)
+              << "Inserts/sec: " << (out_sec > 0 ? out_nodes / out_sec : 0.0) << " outside, "
+              << (in_sec > 0 ? in_nodes / in_sec : 0.0) << " during snapshot\n"
+              << "Searches/sec: " << (out_sec > 0 ? out_q / out_sec : 0.0) << " outside, "
+              << (in_sec > 0 ? in_q / in_sec : 0.0) << " during snapshot\n"
+              << std::defaultfloat << std::setprecision(6);
+
+    HNSW loaded(w.dim);
+    std::ifstream f(p.snapshot, std::ios::binary);
+    loaded.load(f);
+    std::cout << "Loaded image: " << loaded.size() << " nodes, " << loaded.link_count() << " links\n";
 
-    if (avg_recall < 0.95f) {
+    // Nodes linked in just before the cut must be reachable in the image: each second-half row
+    // of the image should find itself about as often as in the live index
+    auto self_found = [&](const HNSW &idx) {
+        size_t found = 0;
+        std::vector<float> buf;
+        for (size_t i = half; i < w.size(); i++) {
+            auto top = idx.search_scored(w.row(i, buf), 1, p.efs);
+            found += !top.empty() && top[0].second == (int) i;
+        }
+        return found;
+    };
+    std::cout << "Second-half rows finding themselves (k 1, efs " << p.efs << "): " << self_found(loaded) << " of "
+              << loaded.size() - half << " in the image, " << self_found(index) << " of " << w.size() - half
+              << " in the live index\n";
+}
+
+// ------------------------- SSD-resident HNSW -------------------------
+// --disk FILE: lay the index out in FILE (full vectors + level-0 links) with PQ codes and the
+// upper layers in RAM, then search it at L = efs/2, efs, 2 efs with a --beam wide beam, over
+// io_uring and over pread. IOs and rounds are sector reads and dependent read batches per query.
+void compare_with_disk(const KnnWorkload &w, const HNSW &index, const SearchEval &eval, const CmdArgs &p) {
+    DiskHNSW::Params dp;
+    dp.pq_m = p.pq_m;
+    dp.threads = p.threads;
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    DiskHNSW disk(index, p.disk, dp);
+    double sec = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+    size_t ram = index.size() * (w.dim * sizeof(float)) + index.link_count() * sizeof(int);
+
+    std::cout << "\n[UT1] HNSW vs SSD-resident HNSW (" << p.disk << ", beam " << p.beam << ")\n"
+              << "[TIME] Disk layout + PQ (" << disk.pq_bytes() << " bytes/vector) built in " << sec << " sec\n"
+              << "File: " << disk.file_bytes() / 1024 << " KiB (" << disk.record_bytes() << "-byte records), RAM: "
+              << disk.memory_bytes() / 1024 << " KiB vs " << ram / 1024 << " KiB of vectors + links in memory\n"
+              << std::left << std::setw(28) << "index" << std::right
+              << std::setw(6) << "L" << std::setw(10) << "recall" << std::setw(10) << "IOs/q"
+              << std::setw(10) << "rounds/q" << std::setw(10) << "mean_us" << std::setw(10) << "p99_us" << "\n";
+    auto row = [&](const std::string &name, int L, const SearchEval &e, double ios, double rounds) {
+        std::cout << std::left << std::setw(28) << name << std::right << std::setw(6) << L << std::fixed
+                  << std::setprecision(4) << std::setw(10) << e.recall
+                  << std::setprecision(1) << std::setw(10) << ios << std::setw(10) << rounds
+                  << std::setw(10) << e.avg_time * 1e6
+                  << std::setw(10) << e.latency.percentile_ns(0.99) / 1e3 << "\n"
+                  << std::defaultfloat << std::setprecision(6);
+    };
+    row("hnsw (memory)", p.efs, eval, 0, 0);
+
+    for (bool uring: {true, false}) {
+        disk.use_io_uring(uring);
+        for (int L: {std::max(p.k, p.efs / 2), p.efs, 2 * p.efs}) {
+            size_t ios = 0, rounds = 0;
+            auto e = evaluate_search([&](size_t q, SearchStats &) {
+                DiskHNSW::IoStats st;
+                auto res = disk.search(w.queries[q], p.k, L, p.beam, &st);
+                ios += st.ios;
+                rounds += st.rounds;
+                return res;
+            }, w.queries, w.exact, p.k);
+            row("disk/" + disk.backend(), L, e, double(ios) / w.queries.size(), double(rounds) / w.queries.size());
+        }
+    }
+
+    // As a restarted process would: reopen the file, reading only its header and in-memory part
+    t0 = std::chrono::high_resolution_clock::now();
+    auto reopened = DiskHNSW::open(p.disk, w.dim);
+    sec = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+    size_t ios = 0, rounds = 0, same = 0;
+    auto e = evaluate_search([&](size_t q, SearchStats &) {
+        DiskHNSW::IoStats st;
+        auto res = reopened->search(w.queries[q], p.k, p.efs, p.beam, &st);
+        ios += st.ios;
+        rounds += st.rounds;
+        return res;
+    }, w.queries, w.exact, p.k);
+    for (auto &q: w.queries) same += reopened->search(q, p.k, p.efs, p.beam) == disk.search(q, p.k, p.efs, p.beam);
+    row("reopened/" + reopened->backend(), p.efs, e, double(ios) / w.queries.size(), double(rounds) / w.queries.size());
+    std::cout << "[TIME] Reopened in " << sec << " sec (in-memory part " << reopened->memory_bytes() / 1024 << " KiB), "
+              << same << "/" << w.queries.size() << " result lists identical to the built index\n";
+}
+
+// ------------------------- Batched search modes -------------------------
+// --mq N / --interleave W: the same queries through search_batch (one graph walk per query),
+// search_multi (N queries per lockstep walk) and search_interleaved (W coroutine searches in
+// flight per thread), all on --threads workers
+void compare_search_modes(const HNSW &index, const std::vector<std::vector<float>> &queries,
+                          const std::vector<std::vector<int>> &exact, const CmdArgs &p) {
+    std::vector<float> flat;
+    flat.reserve(queries.size() * index.dim());
+    for (const auto &q: queries) flat.insert(flat.end(), q.begin(), q.end());
+
+    // Best of a few repetitions: a single pass over a few hundred queries is only milliseconds
+    auto timed = [&](auto &&run) {
+        double best = std::numeric_limits<double>::max();
+        std::vector<std::vector<int>> res;
+        for (int rep = 0; rep < 5; rep++) {
+            auto t0 = std::chrono::high_resolution_clock::now();
+            res = run();
+            best = std::min(best, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count());
+        }
+        return std::make_pair(res, best);
+    };
+    auto recall = [&](const std::vector<std::vector<int>> &res) {
+        size_t hit = 0;
+        for (size_t q = 0; q < res.size(); q++)
+            for (int id: res[q])
+                if (std::find(exact[q].begin(), exact[q].end(), id) != exact[q].end()) hit++;
+        return (double) hit / (res.size() * p.k);
+    };
+
+    auto [single, single_sec] = timed([&] { return index.search_batch(queries, p.k, p.efs, p.threads); });
+
+    std::cout << "\n[UT1] Batched search modes (efs " << p.efs << ", " << p.threads << " threads)\n"
+              << std::left << std::setw(18) << "mode" << std::right
+              << std::setw(10) << "QPS" << std::setw(10) << "recall" << std::setw(12) << "identical" << "\n";
+    auto row = [&](const std::string &name, double sec, const std::vector<std::vector<int>> &res) {
+        size_t same = 0;
+        for (size_t q = 0; q < queries.size(); q++) same += (res[q] == single[q]);
+        std::cout << std::left << std::setw(18) << name << std::right << std::fixed
+                  << std::setprecision(0) << std::setw(10) << queries.size() / sec
+                  << std::setprecision(4) << std::setw(10) << recall(res)
+                  << std::setw(12) << (std::to_string(same) + "/" + std::to_string(queries.size())) << "\n"
+                  << std::defaultfloat << std::setprecision(6);
+    };
+    row("search_batch", single_sec, single);
+    if (p.mq > 0) {
+        auto [res, sec] = timed([&] { return index.search_multi(flat, p.k, p.efs, p.mq, p.threads); });
+        row("search_multi/" + std::to_string(p.mq), sec, res);
+    }
+    if (p.interleave > 0) {
+        auto [res, sec] = timed([&] { return index.search_interleaved(flat, p.k, p.efs, p.interleave, p.threads); });
+        row("interleaved/" + std::to_string(p.interleave), sec, res);
+    }
+}
+
+// ------------------------- Test UT -------------------------
+
+void test_hnsw_vs_exact_knn(const CmdArgs &p) {
+    std::cout << "[UT] HNSW vs Exact KNN (L2)\n";
+
+    // --- 1. DATA GENERATION / LOADING, exact KNN (not timed) ---
+    auto w = load_knn_workload(p, p.k);
+    const auto &queries = w.queries;
+    const auto &exact = w.exact;
+
+    // --- 2. INDEX BUILD (single vs multi-thread) ---
+    HNSW index(w.dim, p.M, p.efc);
+    double build_time = build_index(index, w, p);
+
+    // --- 3. QUERY / SEARCH ---
+    SearchEval eval;
+    if (p.efs_auto) {
+        // Fixed efs first as the reference point, then the adaptive mode at 4x the ceiling
+        int patience = p.patience > 0 ? p.patience : auto_patience(p.k);
+        std::cout << "[efs " << p.efs << "]\n";
+        print_search_eval(evaluate_search(index, queries, exact, p.k, p.efs, 0), p.k);
+        std::cout << "[efs auto: ceiling " << 4 * p.efs << ", patience " << patience << "]\n";
+        eval = evaluate_search(index, queries, exact, p.k, 4 * p.efs, patience);
+    } else {
+        eval = evaluate_search(index, queries, exact, p.k, p.efs, 0);
+    }
+    print_search_eval(eval, p.k);
+
+    if (p.threads > 1) {
+        // Throughput over the index's thread pool; results must match the sequential run
+        auto t0 = std::chrono::high_resolution_clock::now();
+        auto batch = index.search_batch(queries, p.k, p.efs, p.threads);
+        double sec = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+        std::cout << "[TIME] Batch search (" << p.threads << " threads): "
+                  << queries.size() / sec << " QPS\n";
+        for (size_t q = 0; q < queries.size(); q++)
+            assert(batch[q] == index.search(queries[q], p.k, p.efs));
+    }
+
+    if (p.mq > 0 || p.interleave > 0) compare_search_modes(index, queries, exact, p);
+
+    if (p.vamana) compare_with_vamana(w, index, build_time, eval, p);
+    if (p.ivf > 0) compare_with_ivf(w, index, build_time, eval, p);
+    if (p.shards > 0) compare_with_shards(w, index, build_time, eval, p);
+    if (p.stream > 0) compare_with_streaming(w, build_time, p);
+    if (!p.wal.empty()) compare_with_wal(w, p);
+    if (!p.snapshot.empty()) compare_with_snapshot(w, p);
+    if (!p.disk.empty()) compare_with_disk(w, index, eval, p);
+
+    if (eval.recall < 0.95f) {
         std::cout << "[FAIL] Recall is too low: "
-                  << avg_recall << "\n";
+                  << eval.recall << "\n";
     } else {
         std::cout << "[PASS] Exact KNN validation\n";
     }
 
-    assert(avg_recall > 0.95f);
+    assert(eval.recall > 0.95f);
 }
 
 //------------------------ Pretty print confusion matrix -------------------------
@@ -191,7 +992,7 @@ void print_normalized_confusion_matrix(
         }
         std::cout << "\n";
     }
-    std::cout << "\n";
+    std::cout << "\n" << std::defaultfloat << std::setprecision(6);
 }
 
 // ------------------------- Majority vote -------------------------
@@ -217,6 +1018,7 @@ void test_hnsw_per_cluster_precision(const CmdArgs &p) {
     std::cout << "\n[UT] HNSW per-cluster precision + confusion matrix\n";
 
     HNSW index(p.dim, p.M, p.efc);
+    index.set_prune(p.alpha, p.keep_pruned);
     std::mt19937 rng(p.seed);
 
     // --- generate well-separated centers ---
@@ -227,6 +1029,7 @@ void test_hnsw_per_cluster_precision(const CmdArgs &p) {
 
     // --- BUILD INDEX: measure time for insert only ---
     double build_time = 0.0;
+    LatencyHistogram insert_latency;
     for (int c = 0; c < p.clusters; c++) {
         for (int i = 0; i < p.pts; i++) {
             auto v = sample_near(centers[c], p.sigma, rng);
@@ -237,9 +1040,11 @@ void test_hnsw_per_cluster_precision(const CmdArgs &p) {
             index.insert(v);// timed
             auto t1 = std::chrono::high_resolution_clock::now();
             build_time += std::chrono::duration<double>(t1 - t0).count();
+            insert_latency.record(t1 - t0);
         }
     }
     std::cout << "[TIME] Total index insert: " << build_time << " sec\n";
+    insert_latency.print("insert");
 
     // --- PREPARE confusion matrix ---
     std::vector<std::vector<int>> confusion(
@@ -249,6 +1054,7 @@ void test_hnsw_per_cluster_precision(const CmdArgs &p) {
 
     // --- QUERY / SEARCH: measure time for search only ---
     double search_time_total = 0.0;
+    LatencyHistogram search_latency;
     for (int true_c = 0; true_c < p.clusters; true_c++) {
         for (int q = 0; q < p.queries; q++) {
             auto query = sample_near(centers[true_c], p.sigma, rng);
@@ -257,6 +1063,7 @@ void test_hnsw_per_cluster_precision(const CmdArgs &p) {
             auto knn = index.search(query, p.k, p.efs);// timed
             auto t1 = std::chrono::high_resolution_clock::now();
             search_time_total += std::chrono::duration<double>(t1 - t0).count();
+            search_latency.record(t1 - t0);
 
             std::vector<int> knn_labels;
             for (int id: knn) knn_labels.push_back(labels[id]);
@@ -270,6 +1077,7 @@ void test_hnsw_per_cluster_precision(const CmdArgs &p) {
 
     double avg_search_time = search_time_total / total_queries;
     std::cout << "[TIME] Avg search per query: " << avg_search_time << " sec\n";
+    search_latency.print("search");
 
     // --- PRINT confusion matrix ---
     print_normalized_confusion_matrix(confusion);
@@ -278,15 +1086,320 @@ void test_hnsw_per_cluster_precision(const CmdArgs &p) {
     std::cout << "[UT2] Recall: " << recall << "\n";
 }
 
+// ------------------------- UT3: Range search -------------------------
+void test_hnsw_range_search(const CmdArgs &p) {
+    std::cout << "\n[UT] HNSW range search vs exact radius scan (L2)\n";
+
+    HNSW index(p.dim, p.M, p.efc);
+    std::mt19937 rng(p.seed);
+
+    auto centers = generate_well_separated_centers(p.dim, p.clusters, p.center_dist);
+
+    std::vector<std::vector<float>> dataset;
+    dataset.reserve(p.clusters * p.pts);
+    for (int c = 0; c < p.clusters; c++)
+        for (int i = 0; i < p.pts; i++)
+            dataset.push_back(sample_near(centers[c], p.sigma, rng));
+
+    build_index(index, dataset, p);
+
+    // Default radius: expected distance between two samples of one cluster,
+    // sigma * sqrt(2 * dim), which catches roughly half of the query's cluster.
+    float radius = p.radius > 0.0f ? p.radius : p.sigma * std::sqrt(2.0f * p.dim);
+    std::cout << "Radius: " << radius << ", max results: " << p.max_results << "\n";
+
+    int total_queries = 0;
+    size_t total_exact = 0, total_hit = 0, total_returned = 0;
+    double approx_time = 0.0, exact_time = 0.0;
+
+    for (int c = 0; c < p.clusters; c++) {
+        for (int q = 0; q < p.queries; q++) {
+            auto query = sample_near(centers[c], p.sigma, rng);
+
+            auto t0 = std::chrono::high_resolution_clock::now();
+            auto exact = exact_range_L2(dataset, query, radius, p.max_results);
+            auto t1 = std::chrono::high_resolution_clock::now();
+            auto approx = index.range_search(query, radius, p.max_results, p.efs);
+            auto t2 = std::chrono::high_resolution_clock::now();
+
+            exact_time += std::chrono::duration<double>(t1 - t0).count();
+            approx_time += std::chrono::duration<double>(t2 - t1).count();
+
+            std::sort(exact.begin(), exact.end());
+            for (int id: approx)
+                if (std::binary_search(exact.begin(), exact.end(), id)) total_hit++;
+            total_exact += exact.size();
+            total_returned += approx.size();
+            total_queries++;
+        }
+    }
+
+    float recall = total_exact ? float(total_hit) / total_exact : 1.0f;
+    float precision = total_returned ? float(total_hit) / total_returned : 1.0f;
+
+    std::cout << "Avg results per query: " << float(total_exact) / total_queries << " (exact), "
+              << float(total_returned) / total_queries << " (HNSW)\n";
+    std::cout << "Range recall: " << recall << "\n";
+    std::cout << "Range precision: " << precision << "\n";
+    std::cout << "[TIME] Avg exact scan per query: " << exact_time / total_queries << " sec\n";
+    std::cout << "[TIME] Avg range search per query: " << approx_time / total_queries << " sec\n";
+
+    if (recall < 0.95f) {
+        std::cout << "[FAIL] Range recall is too low: " << recall << "\n";
+    } else {
+        std::cout << "[PASS] Exact range validation\n";
+    }
+
+    assert(recall > 0.95f);
+}
+
+// ------------------------- UT4: Paginated search -------------------------
+void test_hnsw_search_iterator(const CmdArgs &p) {
+    std::cout << "\n[UT] HNSW search iterator vs repeated full searches\n";
+
+    HNSW index(p.dim, p.M, p.efc);
+    std::mt19937 rng(p.seed);
+
+    auto centers = generate_well_separated_centers(p.dim, p.clusters, p.center_dist);
+
+    std::vector<std::vector<float>> dataset;
+    dataset.reserve(p.clusters * p.pts);
+    for (int c = 0; c < p.clusters; c++)
+        for (int i = 0; i < p.pts; i++)
+            dataset.push_back(sample_near(centers[c], p.sigma, rng));
+
+    build_index(index, dataset, p);
+
+    int depth = p.pages * p.k;
+    int total_queries = 0;
+    float iter_recall = 0.0f, full_recall = 0.0f;
+    std::vector<double> iter_time(p.pages, 0.0), full_time(p.pages, 0.0);
+
+    for (int c = 0; c < p.clusters; c++) {
+        for (int q = 0; q < p.queries; q++) {
+            auto query = sample_near(centers[c], p.sigma, rng);
+            auto exact = exact_knn_L2(dataset, query, depth);
+            std::sort(exact.begin(), exact.end());
+
+            // Iterator: one object, p.pages calls to next(k)
+            std::vector<int> iter_res;
+            auto run_iterator = [&]() {
+                auto t_create = std::chrono::high_resolution_clock::now();
+                auto it = index.search_iterator(query, p.efs);
+                for (int page = 0; page < p.pages; page++) {
+                    auto t0 = std::chrono::high_resolution_clock::now();
+                    auto res = it.next(p.k);
+                    auto t1 = std::chrono::high_resolution_clock::now();
+                    iter_time[page] += std::chrono::duration<double>(t1 - (page ? t0 : t_create)).count();
+                    iter_res.insert(iter_res.end(), res.begin(), res.end());
+                }
+            };
+
+            // Baseline: page N re-runs search with k = N * page size
+            std::vector<int> full_res;
+            auto run_full = [&]() {
+                for (int page = 0; page < p.pages; page++) {
+                    int k = (page + 1) * p.k;
+                    auto t0 = std::chrono::high_resolution_clock::now();
+                    full_res = index.search(query, k, std::max(p.efs, k));
+                    auto t1 = std::chrono::high_resolution_clock::now();
+                    full_time[page] += std::chrono::duration<double>(t1 - t0).count();
+                }
+            };
+
+            // Alternate which one runs first so neither always gets a warm cache
+            if (total_queries % 2) {
+                run_iterator();
+                run_full();
+            } else {
+                run_full();
+                run_iterator();
+            }
+
+            for (int id: iter_res)
+                if (std::binary_search(exact.begin(), exact.end(), id)) iter_recall += 1.0f / depth;
+            for (int id: full_res)
+                if (std::binary_search(exact.begin(), exact.end(), id)) full_recall += 1.0f / depth;
+            total_queries++;
+        }
+    }
+
+    iter_recall /= total_queries;
+    full_recall /= total_queries;
+
+    std::cout << "Page size: " << p.k << ", pages: " << p.pages << "\n\n";
+    std::cout << "Page   Iterator (sec)   Full search (sec)\n";
+    double iter_total = 0.0, full_total = 0.0;
+    for (int page = 0; page < p.pages; page++) {
+        iter_total += iter_time[page];
+        full_total += full_time[page];
+        std::cout << std::setw(4) << page + 1 << "   "
+                  << std::setw(14) << std::scientific << std::setprecision(3) << iter_time[page] / total_queries << "   "
+                  << std::setw(17) << full_time[page] / total_queries << "\n";
+    }
+    std::cout << std::defaultfloat << std::setprecision(6);
+    std::cout << "\n[TIME] Avg all pages (iterator): " << iter_total / total_queries << " sec\n";
+    std::cout << "[TIME] Avg all pages (repeated search): " << full_total / total_queries << " sec\n";
+    std::cout << "Recall@" << depth << " (iterator): " << iter_recall << "\n";
+    std::cout << "Recall@" << depth << " (repeated search): " << full_recall << "\n";
+
+    if (iter_recall < 0.95f) {
+        std::cout << "[FAIL] Iterator recall is too low: " << iter_recall << "\n";
+    } else {
+        std::cout << "[PASS] Paginated search validation\n";
+    }
+
+    assert(iter_recall > 0.95f);
+}
+
+// ------------------------- Sweep: recall vs QPS -------------------------
+struct SweepRow {
+    int k;
+    int ef;
+    SearchEval eval;
+    bool pareto = false;
+};
+
+// A row is Pareto-optimal (per k) when no other row has both higher-or-equal recall and QPS
+void mark_pareto(std::vector<SweepRow> &rows) {
+    for (auto &r: rows) {
+        double qps = 1.0 / r.eval.avg_time;
+        r.pareto = std::none_of(rows.begin(), rows.end(), [&](const SweepRow &o) {
+            double o_qps = 1.0 / o.eval.avg_time;
+            return &o != &r && o.k == r.k && o.eval.recall >= r.eval.recall && o_qps >= qps &&
+                   (o.eval.recall > r.eval.recall || o_qps > qps);
+        });
+    }
+}
+
+// Column names follow ann-benchmarks' result export (algorithm, parameters, k-nn recall, qps)
+void write_sweep_csv(std::ostream &os, const std::vector<SweepRow> &rows, const CmdArgs &p) {
+    os << "algorithm,parameters,k,ef_search,recall,qps,mean_us,p50_us,p99_us,dist_evals,pareto\n";
+    for (const auto &r: rows) {
+        os << "hnsw,\"M=" << p.M << " efc=" << p.efc << " efs=" << r.ef << "\","
+           << r.k << "," << r.ef << "," << r.eval.recall << "," << 1.0 / r.eval.avg_time << ","
+           << r.eval.latency.mean_ns() / 1e3 << "," << r.eval.latency.percentile_ns(0.50) / 1e3 << ","
+           << r.eval.latency.percentile_ns(0.99) / 1e3 << "," << r.eval.avg_dist_evals << ","
+           << (r.pareto ? 1 : 0) << "\n";
+    }
+}
+
+void write_sweep_json(std::ostream &os, const std::vector<SweepRow> &rows, const CmdArgs &p) {
+    os << "[\n";
+    for (size_t i = 0; i < rows.size(); i++) {
+        const auto &r = rows[i];
+        os << "  {\"algorithm\": \"hnsw\", \"parameters\": \"M=" << p.M << " efc=" << p.efc << " efs=" << r.ef << "\""
+           << ", \"M\": " << p.M << ", \"ef_construction\": " << p.efc
+           << ", \"k\": " << r.k << ", \"ef_search\": " << r.ef
+           << ", \"recall\": " << r.eval.recall << ", \"qps\": " << 1.0 / r.eval.avg_time
+           << ", \"mean_us\": " << r.eval.latency.mean_ns() / 1e3
+           << ", \"p50_us\": " << r.eval.latency.percentile_ns(0.50) / 1e3
+           << ", \"p99_us\": " << r.eval.latency.percentile_ns(0.99) / 1e3
+           << ", \"dist_evals\": " << r.eval.avg_dist_evals
+           << ", \"pareto\": " << (r.pareto ? "true" : "false") << "}"
+           << (i + 1 < rows.size() ? "," : "") << "\n";
+    }
+    os << "]\n";
+}
+
+void run_sweep(const CmdArgs &p) {
+    std::cout << "[SWEEP] Recall vs QPS over ef_search";
+    if (p.k_list.size() > 1) std::cout << " and k";
+    std::cout << "\n";
+
+    // Ground truth once, at the largest k; smaller k use its prefix
+    int max_k = *std::max_element(p.k_list.begin(), p.k_list.end());
+    auto w = load_knn_workload(p, max_k);
+    const auto &queries = w.queries;
+    const auto &exact = w.exact;
+
+    HNSW index(w.dim, p.M, p.efc);
+    build_index(index, w, p);
+
+    std::vector<SweepRow> rows;
+    for (int k: p.k_list) {
+        std::vector<std::vector<int>> exact_k = exact;
+        for (auto &e: exact_k) e.resize(std::min<size_t>(e.size(), k));
+
+        for (int ef: p.efs_list) {
+            ef = std::max(ef, k);// search returns at most ef results
+            rows.push_back({k, ef, evaluate_search(index, queries, exact_k, k, ef, 0)});
+            const auto &r = rows.back();
+            std::cout << "k=" << k << " efs=" << ef << "  recall " << r.eval.recall
+                      << "  qps " << 1.0 / r.eval.avg_time << "\n";
+        }
+    }
+    mark_pareto(rows);
+
+    if (p.out.empty()) {
+        write_sweep_csv(std::cout, rows, p);
+        return;
+    }
+
+    std::ofstream f(p.out);
+    if (!f) {
+        std::cerr << "Cannot open " << p.out << "\n";
+        return;
+    }
+    bool json = p.out.size() >= 5 && p.out.compare(p.out.size() - 5, 5, ".json") == 0;
+    if (json)
+        write_sweep_json(f, rows, p);
+    else
+        write_sweep_csv(f, rows, p);
+    std::cout << "[SWEEP] Wrote " << rows.size() << " rows to " << p.out << "\n";
+}
+
+// ------------------------- Serving -------------------------
+// --serve ADDR: build the index from the dataset options, then answer queries until SIGINT /
+// SIGTERM. --loadgen ADDR: replay the workload's queries against it at --rate and report the
+// achieved throughput and latency percentiles.
+static QueryServer *g_server = nullptr;
+
+void run_server(const CmdArgs &p) {
+    auto w = load_knn_workload(p, 0);
+    HNSW index(w.dim, p.M, p.efc);
+    build_index(index, w, p);
+
+    QueryServer::Params sp;
+    sp.batch_max = (size_t) p.batch_max;
+    sp.batch_window = std::chrono::microseconds(p.batch_us);
+    sp.threads = p.threads;
+    QueryServer server(index, sp);
+
+    g_server = &server;
+    auto on_signal = [](int) { g_server->stop(); };
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+    server.run(hnsw_net::Address::parse(p.serve));
+    g_server = nullptr;
+}
+
+void run_loadgen_client(const CmdArgs &p) {
+    auto w = load_knn_workload(p, 0);
+    auto addr = hnsw_net::Address::parse(p.loadgen);
+    std::cout << "[LOADGEN] " << addr.str() << ": " << p.rate << " q/s for " << p.duration << " s over "
+              << p.conns << " connections (k=" << p.k << ", efs=" << p.efs << ")\n";
+
+    auto r = run_loadgen(addr, w.queries, p.k, p.efs, p.rate, p.duration, p.conns);
+    std::cout << "[LOADGEN] Completed " << r.completed << "/" << r.sent << " queries in " << r.seconds
+              << " s, achieved " << (r.seconds > 0 ? r.completed / r.seconds : 0.0) << " QPS\n";
+    r.latency.print("end-to-end (from scheduled send)");
+}
+
 // ------------------------- Main -------------------------
-int main(int argc, char **argv) {
+int main(int argc, char **argv) try {
     auto args = parse_args(argc, argv);
 
-    if (!args.ut1 && !args.ut2) {
+    if (!args.ut1 && !args.ut2 && !args.ut3 && !args.ut4 && !args.sweep && args.gen.empty() &&
+        args.serve.empty() && args.loadgen.empty()) {
         print_usage(argv[0]);
         return 0;
     }
 
+    if (!args.gen.empty()) {
+        write_synthetic_fvecs(args);
+    }
+
     if (args.ut1) {
         test_hnsw_vs_exact_knn(args);
     }
@@ -295,5 +1408,28 @@ int main(int argc, char **argv) {
         test_hnsw_per_cluster_precision(args);
     }
 
+    if (args.ut3) {
+        test_hnsw_range_search(args);
+    }
+
+    if (args.ut4) {
+        test_hnsw_search_iterator(args);
+    }
+
+    if (args.sweep) {
+        run_sweep(args);
+    }
+
+    if (!args.serve.empty()) {
+        run_server(args);
+    }
+
+    if (!args.loadgen.empty()) {
+        run_loadgen_client(args);
+    }
+
     return 0;
+} catch (const std::exception &e) {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
 }
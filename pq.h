@@ -0,0 +1,130 @@
+#ifndef HNSW_PQ_H
+#define HNSW_PQ_H
+
+#include "distance.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <limits>
+#include <numeric>
+#include <ostream>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+// ------------------------- Product quantization -------------------------
+// Jégou et al., TPAMI'11: the vector is cut into m sub-vectors, each replaced by the id of its
+// nearest of 256 sub-centroids (k-means per subspace), so a vector costs m bytes. A query
+// precomputes its squared distance to every sub-centroid (m x 256 table); the distance to a
+// code is then m table lookups (asymmetric distance computation).
+class ProductQuantizer {
+public:
+    static constexpr int KSUB = 256;
+
+    ProductQuantizer() = default;
+    ProductQuantizer(int dim, int m) : dim_(dim), m_(m), dsub_(dim / m) {
+        if (m < 1 || dim % m != 0) throw std::invalid_argument("ProductQuantizer: m must divide dim");
+    }
+
+    // k-means per subspace on n rows (get_row(i, buf) as for HNSW::insert_batch), evenly
+    // sampled down to train_size
+    template<class GetRow>
+    void train(size_t n, GetRow &&get_row, ThreadPool &tp, size_t train_size = 65536, int iters = 10,
+               uint32_t seed = 42) {
+        const size_t s = std::min(n, train_size);
+        if (s < (size_t) KSUB) throw std::invalid_argument("ProductQuantizer: need at least 256 training rows");
+        std::vector<float> sample(s * dim_), buf;
+        for (size_t i = 0; i < s; i++) {
+            std::span<const float> row = get_row(i * n / s, buf);
+            std::copy(row.begin(), row.end(), sample.begin() + i * dim_);
+        }
+
+        centroids_.assign((size_t) m_ * KSUB * dsub_, 0.0f);
+        tp.parallel_for(0, m_, [&](size_t j, int) {
+            std::mt19937 rng(seed + (uint32_t) j);
+            auto sub = [&](size_t i) { return sample.data() + i * dim_ + j * dsub_; };
+            float *cent = centroids_.data() + j * KSUB * dsub_;
+
+            std::vector<size_t> pick(s);
+            std::iota(pick.begin(), pick.end(), 0);
+            std::shuffle(pick.begin(), pick.end(), rng);
+            for (int c = 0; c < KSUB; c++) std::copy_n(sub(pick[c]), dsub_, cent + c * dsub_);
+
+            std::vector<int> assign(s);
+            std::vector<double> sum((size_t) KSUB * dsub_);
+            std::vector<size_t> cnt(KSUB);
+            for (int it = 0; it < iters; it++) {
+                for (size_t i = 0; i < s; i++) assign[i] = nearest(cent, sub(i));
+                std::fill(sum.begin(), sum.end(), 0.0);
+                std::fill(cnt.begin(), cnt.end(), 0);
+                for (size_t i = 0; i < s; i++) {
+                    cnt[assign[i]]++;
+                    for (int d = 0; d < dsub_; d++) sum[assign[i] * dsub_ + d] += sub(i)[d];
+                }
+                for (int c = 0; c < KSUB; c++) {
+                    if (cnt[c] == 0) {
+                        std::copy_n(sub(rng() % s), dsub_, cent + c * dsub_);
+                        continue;
+                    }
+                    for (int d = 0; d < dsub_; d++) cent[c * dsub_ + d] = float(sum[c * dsub_ + d] / cnt[c]);
+                }
+            }
+        });
+    }
+
+    // m bytes
+    void encode(std::span<const float> v, uint8_t *code) const {
+        for (int j = 0; j < m_; j++) code[j] = (uint8_t) nearest(centroids_.data() + j * KSUB * dsub_, v.data() + j * dsub_);
+    }
+
+    // m x 256 squared distances of the query's sub-vectors to the sub-centroids
+    void distance_table(std::span<const float> q, float *table) const {
+        for (int j = 0; j < m_; j++)
+            for (int c = 0; c < KSUB; c++)
+                table[j * KSUB + c] = l2_distance(q.data() + j * dsub_, centroids_.data() + (j * KSUB + c) * dsub_, dsub_);
+    }
+
+    float distance(const float *table, const uint8_t *code) const {
+        float d = 0.0f;
+        for (int j = 0; j < m_; j++) d += table[j * KSUB + code[j]];
+        return d;
+    }
+
+    int m() const { return m_; }
+    int dim() const { return dim_; }
+    size_t memory_bytes() const { return centroids_.size() * sizeof(float); }
+
+    // dim, m and the codebooks; load() throws std::runtime_error on a truncated stream
+    void save(std::ostream &os) const {
+        int32_t hdr[2] = {dim_, m_};
+        os.write(reinterpret_cast<const char *>(hdr), sizeof(hdr));
+        os.write(reinterpret_cast<const char *>(centroids_.data()), centroids_.size() * sizeof(float));
+    }
+
+    void load(std::istream &is) {
+        int32_t hdr[2];
+        if (!is.read(reinterpret_cast<char *>(hdr), sizeof(hdr))) throw std::runtime_error("ProductQuantizer: truncated");
+        *this = ProductQuantizer(hdr[0], hdr[1]);
+        centroids_.resize((size_t) m_ * KSUB * dsub_);
+        if (!is.read(reinterpret_cast<char *>(centroids_.data()), centroids_.size() * sizeof(float)))
+            throw std::runtime_error("ProductQuantizer: truncated");
+    }
+
+private:
+    int dim_ = 0, m_ = 0, dsub_ = 0;
+    std::vector<float> centroids_;// m x 256 x dsub
+
+    int nearest(const float *cent, const float *x) const {
+        int best = 0;
+        float bd = std::numeric_limits<float>::max();
+        for (int c = 0; c < KSUB; c++) {
+            float d = l2_distance(x, cent + c * dsub_, dsub_);
+            if (d < bd) bd = d, best = c;
+        }
+        return best;
+    }
+};
+
+#endif// HNSW_PQ_H
@@ -0,0 +1,211 @@
+#ifndef HNSW_SECTOR_IO_H
+#define HNSW_SECTOR_IO_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HNSW_HAVE_IO_URING 1
+#endif
+
+// ------------------------- Sector reads -------------------------
+// Batched reads of whole SECTOR-sized blocks of one file, into SECTOR-aligned buffers so the
+// file can be opened with O_DIRECT (page cache bypassed; tmpfs and other file systems that
+// refuse O_DIRECT fall back to buffered reads). A batch is submitted to an io_uring in one
+// io_uring_enter() and reaped together; where io_uring is unavailable (old kernel, seccomp)
+// or predates IORING_OP_READ (before 5.6) it falls back to one pread() per sector. Not
+// thread-safe: one reader per thread.
+
+constexpr size_t SECTOR = 4096;
+
+struct SectorBuffer {
+    std::unique_ptr<char, decltype(&std::free)> data{nullptr, &std::free};
+    size_t sectors = 0;
+
+    void reserve(size_t n) {
+        if (n <= sectors) return;
+        data.reset(static_cast<char *>(std::aligned_alloc(SECTOR, n * SECTOR)));
+        if (!data) throw std::bad_alloc();
+        sectors = n;
+    }
+    char *sector(size_t i) const { return data.get() + i * SECTOR; }
+};
+
+class SectorReader {
+public:
+    // try_uring = false forces the pread() path
+    SectorReader(const std::string &path, bool try_uring = true) {
+        fd_ = ::open(path.c_str(), O_RDONLY | O_DIRECT);
+        direct_ = fd_ >= 0;
+        if (fd_ < 0) fd_ = ::open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) throw std::runtime_error("Cannot open " + path);
+#ifdef HNSW_HAVE_IO_URING
+        if (try_uring) uring_ = setup_ring();
+#else
+        (void) try_uring;
+#endif
+    }
+
+    ~SectorReader() {
+#ifdef HNSW_HAVE_IO_URING
+        close_ring();
+#endif
+        ::close(fd_);
+    }
+
+    SectorReader(const SectorReader &) = delete;
+    SectorReader &operator=(const SectorReader &) = delete;
+
+    // Sector sectors[i] into out.sector(i), for every i
+    void read(const std::vector<uint64_t> &sectors, SectorBuffer &out) {
+        out.reserve(sectors.size());
+#ifdef HNSW_HAVE_IO_URING
+        if (uring_) {
+            for (size_t at = 0; at < sectors.size(); at += RING_ENTRIES)
+                read_ring(sectors, at, std::min(sectors.size(), at + RING_ENTRIES), out);
+            reads_ += sectors.size();
+            return;
+        }
+#endif
+        for (size_t i = 0; i < sectors.size(); i++) {
+            ssize_t r = ::pread(fd_, out.sector(i), SECTOR, (off_t) (sectors[i] * SECTOR));
+            if (r != (ssize_t) SECTOR) throw std::runtime_error("SectorReader: short read");
+        }
+        reads_ += sectors.size();
+    }
+
+    const char *backend() const { return uring_ ? "io_uring" : "pread"; }
+    bool direct() const { return direct_; }
+    size_t reads() const { return reads_; }
+
+private:
+    int fd_ = -1;
+    bool direct_ = false;
+    bool uring_ = false;
+    size_t reads_ = 0;
+
+#ifdef HNSW_HAVE_IO_URING
+    static constexpr unsigned RING_ENTRIES = 64;
+
+    int ring_fd_ = -1;
+    void *sq_ptr_ = MAP_FAILED, *cq_ptr_ = MAP_FAILED, *sqes_ptr_ = MAP_FAILED;
+    size_t sq_bytes_ = 0, cq_bytes_ = 0, sqes_bytes_ = 0;
+    unsigned *sq_tail_ = nullptr, *sq_mask_ = nullptr, *sq_array_ = nullptr;
+    unsigned *cq_head_ = nullptr, *cq_tail_ = nullptr, *cq_mask_ = nullptr;
+    io_uring_sqe *sqes_ = nullptr;
+    io_uring_cqe *cqes_ = nullptr;
+
+    // Plain syscalls and mmap'd rings (no liburing dependency); false if the kernel says no,
+    // either to the ring itself or to a probe read of sector 0 through it
+    bool setup_ring() {
+        if (!map_ring()) {
+            close_ring();
+            return false;
+        }
+        SectorBuffer probe;
+        probe.reserve(1);
+        if (ring_batch({0}, 0, 1, probe) < 0) {
+            close_ring();
+            return false;
+        }
+        return true;
+    }
+
+    void close_ring() {
+        if (sqes_ptr_ != MAP_FAILED) ::munmap(sqes_ptr_, sqes_bytes_);
+        if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) ::munmap(cq_ptr_, cq_bytes_);
+        if (sq_ptr_ != MAP_FAILED) ::munmap(sq_ptr_, sq_bytes_);
+        if (ring_fd_ >= 0) ::close(ring_fd_);
+        sq_ptr_ = cq_ptr_ = sqes_ptr_ = MAP_FAILED;
+        ring_fd_ = -1;
+    }
+
+    bool map_ring() {
+        io_uring_params p{};
+        ring_fd_ = (int) ::syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+        if (ring_fd_ < 0) return false;
+
+        sq_bytes_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cq_bytes_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) sq_bytes_ = cq_bytes_ = std::max(sq_bytes_, cq_bytes_);
+        sq_ptr_ = ::mmap(nullptr, sq_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+        cq_ptr_ = single ? sq_ptr_
+                         : ::mmap(nullptr, cq_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                                  IORING_OFF_CQ_RING);
+        sqes_bytes_ = p.sq_entries * sizeof(io_uring_sqe);
+        sqes_ptr_ = ::mmap(nullptr, sqes_bytes_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_,
+                           IORING_OFF_SQES);
+        if (sq_ptr_ == MAP_FAILED || cq_ptr_ == MAP_FAILED || sqes_ptr_ == MAP_FAILED) return false;
+
+        auto *sq = static_cast<char *>(sq_ptr_);
+        auto *cq = static_cast<char *>(cq_ptr_);
+        sq_tail_ = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+        sq_mask_ = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+        cq_head_ = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+        cq_mask_ = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+        sqes_ = static_cast<io_uring_sqe *>(sqes_ptr_);
+        return true;
+    }
+
+    void read_ring(const std::vector<uint64_t> &sectors, size_t lo, size_t hi, SectorBuffer &out) {
+        if (ring_batch(sectors, lo, hi, out) != (int) SECTOR) throw std::runtime_error("SectorReader: short read");
+    }
+
+    // One submission of sectors [lo, hi), then wait for all of their completions. Returns
+    // SECTOR, or the first completion result that is not (a short read or -errno); every
+    // completion is reaped either way, so none is left for the next batch to miscount.
+    int ring_batch(const std::vector<uint64_t> &sectors, size_t lo, size_t hi, SectorBuffer &out) {
+        unsigned tail = *sq_tail_;
+        for (size_t i = lo; i < hi; i++, tail++) {
+            unsigned idx = tail & *sq_mask_;
+            io_uring_sqe &sqe = sqes_[idx];
+            std::memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_READ;
+            sqe.fd = fd_;
+            sqe.addr = (uint64_t) (uintptr_t) out.sector(i);
+            sqe.len = SECTOR;
+            sqe.off = sectors[i] * SECTOR;
+            sqe.user_data = i;
+            sq_array_[idx] = idx;
+        }
+        __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+        const unsigned n = (unsigned) (hi - lo);
+        unsigned submit = n, done = 0;
+        int result = (int) SECTOR;
+        while (done < n) {
+            int r = (int) ::syscall(__NR_io_uring_enter, ring_fd_, submit, n - done, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (r < 0 && errno != EINTR) throw std::runtime_error("SectorReader: io_uring_enter failed");
+            if (r > 0) submit -= std::min<unsigned>(submit, (unsigned) r);
+
+            unsigned head = *cq_head_;
+            for (unsigned ctail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE); head != ctail; head++, done++) {
+                int res = cqes_[head & *cq_mask_].res;
+                if (res != (int) SECTOR && result == (int) SECTOR) result = res;
+            }
+            __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+        }
+        return result;
+    }
+#endif
+};
+
+#endif// HNSW_SECTOR_IO_H
@@ -0,0 +1,391 @@
+#ifndef HNSW_SERVER_H
+#define HNSW_SERVER_H
+
+#include "histogram.h"
+#include "hnsw.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// ------------------------- Query server -------------------------
+// Local query service over a Unix domain socket ("unix:/path") or localhost TCP ("tcp:PORT").
+// Binary protocol in host byte order (both ends run on the same machine); a connection may
+// pipeline any number of requests and gets the responses in request order:
+//
+//   request:  uint32 magic ('HNSQ'), uint32 k, uint32 ef (0 = index default), uint32 dim,
+//             dim x float32
+//   response: uint32 count, count x int32 label (closest first)
+//
+// One reader thread per connection queues requests; a single batcher coalesces everything
+// that arrives within a time window (or until the batch is full) and runs it through
+// HNSW::search_multi, one call per distinct (k, ef): queries of a batch walk the graph in
+// lockstep groups that share node reads and batched distance kernels, and the groups are
+// spread over the thread pool.
+
+namespace hnsw_net {
+
+constexpr uint32_t MAGIC = 0x51534E48;// "HNSQ"
+
+struct RequestHeader {
+    uint32_t magic, k, ef, dim;
+};
+
+// Whole-buffer socket I/O; false once the peer is gone
+inline bool read_full(int fd, void *buf, size_t n) {
+    auto *p = static_cast<char *>(buf);
+    while (n > 0) {
+        ssize_t r = ::read(fd, p, n);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r, n -= r;
+    }
+    return true;
+}
+
+inline bool write_full(int fd, const void *buf, size_t n) {
+    auto *p = static_cast<const char *>(buf);
+    while (n > 0) {
+        ssize_t r = ::send(fd, p, n, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return false;
+        p += r, n -= r;
+    }
+    return true;
+}
+
+// "unix:/path" or "tcp:PORT" (127.0.0.1 only)
+struct Address {
+    bool unix_socket = true;
+    std::string path;
+    int port = 0;
+
+    static Address parse(const std::string &s) {
+        Address a;
+        if (s.rfind("unix:", 0) == 0) {
+            a.path = s.substr(5);
+        } else if (s.rfind("tcp:", 0) == 0) {
+            a.unix_socket = false;
+            a.port = std::stoi(s.substr(4));
+        } else {
+            throw std::runtime_error("Bad address (expected unix:/path or tcp:PORT): " + s);
+        }
+        return a;
+    }
+
+    int connect_socket() const {
+        int fd = unix_socket ? ::socket(AF_UNIX, SOCK_STREAM, 0) : ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) throw std::runtime_error("socket() failed");
+        int rc;
+        if (unix_socket) {
+            sockaddr_un sa = unix_addr();
+            rc = ::connect(fd, reinterpret_cast<sockaddr *>(&sa), sizeof(sa));
+        } else {
+            int one = 1;
+            ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            sockaddr_in sa = tcp_addr();
+            rc = ::connect(fd, reinterpret_cast<sockaddr *>(&sa), sizeof(sa));
+        }
+        if (rc < 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot connect to " + str());
+        }
+        return fd;
+    }
+
+    int listen_socket() const {
+        int fd = unix_socket ? ::socket(AF_UNIX, SOCK_STREAM, 0) : ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) throw std::runtime_error("socket() failed");
+        int rc;
+        if (unix_socket) {
+            ::unlink(path.c_str());
+            sockaddr_un sa = unix_addr();
+            rc = ::bind(fd, reinterpret_cast<sockaddr *>(&sa), sizeof(sa));
+        } else {
+            int one = 1;
+            ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            sockaddr_in sa = tcp_addr();
+            rc = ::bind(fd, reinterpret_cast<sockaddr *>(&sa), sizeof(sa));
+        }
+        if (rc < 0 || ::listen(fd, 128) < 0) {
+            ::close(fd);
+            throw std::runtime_error("Cannot listen on " + str());
+        }
+        return fd;
+    }
+
+    std::string str() const { return unix_socket ? "unix:" + path : "tcp:127.0.0.1:" + std::to_string(port); }
+
+private:
+    sockaddr_un unix_addr() const {
+        sockaddr_un sa{};
+        sa.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(sa.sun_path)) throw std::runtime_error("Socket path too long: " + path);
+        std::strncpy(sa.sun_path, path.c_str(), sizeof(sa.sun_path) - 1);
+        return sa;
+    }
+
+    sockaddr_in tcp_addr() const {
+        sockaddr_in sa{};
+        sa.sin_family = AF_INET;
+        sa.sin_port = htons((uint16_t) port);
+        sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return sa;
+    }
+};
+
+}// namespace hnsw_net
+
+class QueryServer {
+public:
+    struct Params {
+        size_t batch_max = 64;                       // flush once this many requests wait
+        std::chrono::microseconds batch_window{200};// ... or this long after the first one
+        int group = 8;                               // search_multi lockstep group
+        int threads = 1;                             // search_multi workers
+    };
+
+    QueryServer(const HNSW &index, const Params &sp) : index_(index), sp_(sp) {}
+
+    // Serves until stop() (e.g. from a signal handler), then closes every connection
+    void run(const hnsw_net::Address &addr) {
+        int lfd = addr.listen_socket();
+        std::thread batcher([this]() { batch_loop(); });
+        std::cout << "[SERVE] Listening on " << addr.str() << " (batch max " << sp_.batch_max << ", window "
+                  << sp_.batch_window.count() << " us, " << sp_.threads << " threads)" << std::endl;
+
+        while (!stop_.load()) {
+            pollfd pfd{lfd, POLLIN, 0};
+            if (::poll(&pfd, 1, 100) <= 0) continue;
+            int fd = ::accept(lfd, nullptr, nullptr);
+            if (fd < 0) continue;
+            auto conn = std::make_shared<Conn>(fd);
+            {
+                std::lock_guard lock(conns_mutex_);
+                conns_.insert(conn);
+            }
+            // A reader drops its connection when the client goes away; the fd closes once
+            // the batcher holds no more requests from it
+            std::thread([this, conn]() {
+                read_loop(conn);
+                std::lock_guard lock(conns_mutex_);
+                conns_.erase(conn);
+                conns_cv_.notify_all();
+            }).detach();
+        }
+
+        {
+            std::unique_lock lock(conns_mutex_);
+            for (auto &c: conns_) ::shutdown(c->fd, SHUT_RDWR);
+            conns_cv_.wait(lock, [&]() { return conns_.empty(); });
+        }
+        {
+            std::lock_guard lock(m_);
+            cv_.notify_all();
+        }
+        batcher.join();
+        ::close(lfd);
+        if (addr.unix_socket) ::unlink(addr.path.c_str());
+
+        std::cout << "[SERVE] " << served_ << " queries in " << batches_ << " batches (mean batch "
+                  << (batches_ ? double(served_) / batches_ : 0.0) << ")\n";
+        latency_.print("server queue + search");
+    }
+
+    // Async-signal-safe: run() notices within one poll interval
+    void stop() { stop_.store(true); }
+
+private:
+    struct Conn {
+        int fd;
+        std::mutex write_mutex;
+        explicit Conn(int f) : fd(f) {}
+        ~Conn() { ::close(fd); }
+    };
+
+    struct Pending {
+        std::shared_ptr<Conn> conn;
+        uint32_t k, ef;
+        std::vector<float> query;
+        std::chrono::steady_clock::time_point arrived;
+    };
+
+    const HNSW &index_;
+    Params sp_;
+    std::atomic<bool> stop_{false};
+
+    std::mutex m_;
+    std::condition_variable cv_;
+    std::deque<Pending> queue_;
+
+    // Connections whose reader is still running
+    std::mutex conns_mutex_;
+    std::condition_variable conns_cv_;
+    std::unordered_set<std::shared_ptr<Conn>> conns_;
+
+    // Batcher thread only
+    size_t served_ = 0, batches_ = 0;
+    LatencyHistogram latency_;
+
+    void read_loop(const std::shared_ptr<Conn> &conn) {
+        hnsw_net::RequestHeader h;
+        while (hnsw_net::read_full(conn->fd, &h, sizeof(h))) {
+            if (h.magic != hnsw_net::MAGIC || h.dim != (uint32_t) index_.dim() || h.k == 0) break;// drop the connection
+            Pending p{conn, h.k, h.ef, std::vector<float>(h.dim), {}};
+            if (!hnsw_net::read_full(conn->fd, p.query.data(), h.dim * sizeof(float))) break;
+            p.arrived = std::chrono::steady_clock::now();
+            {
+                std::lock_guard lock(m_);
+                queue_.push_back(std::move(p));
+            }
+            cv_.notify_one();
+        }
+    }
+
+    void batch_loop() {
+        std::vector<Pending> batch;
+        while (true) {
+            {
+                std::unique_lock lock(m_);
+                cv_.wait(lock, [&]() { return stop_.load() || !queue_.empty(); });
+                if (stop_.load() && queue_.empty()) return;
+                auto deadline = queue_.front().arrived + sp_.batch_window;
+                cv_.wait_until(lock, deadline, [&]() { return stop_.load() || queue_.size() >= sp_.batch_max; });
+                size_t n = std::min(queue_.size(), sp_.batch_max);
+                batch.assign(std::make_move_iterator(queue_.begin()), std::make_move_iterator(queue_.begin() + n));
+                queue_.erase(queue_.begin(), queue_.begin() + n);
+            }
+            run_batch(batch);
+        }
+    }
+
+    // One search_multi call per distinct (k, ef), then the responses in arrival order
+    void run_batch(std::vector<Pending> &batch) {
+        std::map<std::pair<uint32_t, uint32_t>, std::vector<size_t>> groups;
+        for (size_t i = 0; i < batch.size(); i++) groups[{batch[i].k, batch[i].ef}].push_back(i);
+
+        std::vector<std::vector<int>> res(batch.size());
+        std::vector<float> flat;
+        for (auto &[key, items]: groups) {
+            flat.clear();
+            for (size_t i: items) flat.insert(flat.end(), batch[i].query.begin(), batch[i].query.end());
+            auto found = index_.search_multi(std::span<const float>(flat), (int) key.first,
+                                             key.second ? (int) key.second : -1, sp_.group, sp_.threads);
+            for (size_t j = 0; j < items.size(); j++) res[items[j]] = std::move(found[j]);
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        std::vector<char> out;
+        for (size_t i = 0; i < batch.size(); i++) {
+            uint32_t count = (uint32_t) res[i].size();
+            out.resize(sizeof(count) + count * sizeof(int32_t));
+            std::memcpy(out.data(), &count, sizeof(count));
+            std::memcpy(out.data() + sizeof(count), res[i].data(), count * sizeof(int32_t));
+            std::lock_guard lock(batch[i].conn->write_mutex);
+            hnsw_net::write_full(batch[i].conn->fd, out.data(), out.size());
+            latency_.record(now - batch[i].arrived);
+        }
+        served_ += batch.size();
+        batches_++;
+        batch.clear();
+    }
+};
+
+// ------------------------- Load generator -------------------------
+// Open-loop client: request j is due at start + j / rate and goes out on connection j % conns,
+// whether or not earlier ones have been answered. Latency runs from the due time to the
+// response, so a server that falls behind shows up as queueing delay instead of being hidden
+// by a slower send rate (no coordinated omission).
+struct LoadgenResult {
+    size_t sent = 0, completed = 0;
+    double seconds = 0.0;// first due time to last response
+    LatencyHistogram latency;
+};
+
+inline LoadgenResult run_loadgen(const hnsw_net::Address &addr, const std::vector<std::vector<float>> &queries,
+                                 int k, int ef, double rate, double duration_s, int conns) {
+    using clock = std::chrono::steady_clock;
+    const size_t total = std::max<size_t>(1, size_t(rate * duration_s));
+    const auto start = clock::now() + std::chrono::milliseconds(50);
+    auto due = [&](size_t j) { return start + std::chrono::nanoseconds((long long) (j * 1e9 / rate)); };
+
+    std::vector<LatencyHistogram> hist(conns);
+    std::vector<size_t> done(conns, 0);
+    std::vector<clock::time_point> last(conns, start);
+    std::vector<std::thread> threads;
+    std::atomic<bool> failed{false};
+
+    for (int c = 0; c < conns; c++) {
+        int fd = addr.connect_socket();
+        threads.emplace_back([&, c, fd]() {
+            std::thread sender([&, fd]() {
+                std::vector<char> req;
+                for (size_t j = c; j < total; j += conns) {
+                    const auto &q = queries[j % queries.size()];
+                    hnsw_net::RequestHeader h{hnsw_net::MAGIC, (uint32_t) k, (uint32_t) ef, (uint32_t) q.size()};
+                    req.resize(sizeof(h) + q.size() * sizeof(float));
+                    std::memcpy(req.data(), &h, sizeof(h));
+                    std::memcpy(req.data() + sizeof(h), q.data(), q.size() * sizeof(float));
+                    std::this_thread::sleep_until(due(j));
+                    if (!hnsw_net::write_full(fd, req.data(), req.size())) {
+                        failed = true;
+                        return;
+                    }
+                }
+            });
+            std::vector<int32_t> labels;
+            for (size_t j = c; j < total; j += conns) {
+                uint32_t count;
+                if (!hnsw_net::read_full(fd, &count, sizeof(count))) {
+                    failed = true;
+                    break;
+                }
+                labels.resize(count);
+                if (!hnsw_net::read_full(fd, labels.data(), count * sizeof(int32_t))) {
+                    failed = true;
+                    break;
+                }
+                last[c] = clock::now();
+                hist[c].record(last[c] - due(j));
+                done[c]++;
+            }
+            ::shutdown(fd, SHUT_RDWR);
+            sender.join();
+            ::close(fd);
+        });
+    }
+    for (auto &t: threads) t.join();
+    if (failed) std::cerr << "[LOADGEN] Connection lost before all responses arrived\n";
+
+    LoadgenResult r;
+    r.sent = total;
+    auto end = start;
+    for (int c = 0; c < conns; c++) {
+        r.latency.merge(hist[c]);
+        r.completed += done[c];
+        end = std::max(end, last[c]);
+    }
+    r.seconds = std::chrono::duration<double>(end - start).count();
+    return r;
+}
+
+#endif// HNSW_SERVER_H
@@ -0,0 +1,151 @@
+#ifndef HNSW_SHARDED_HNSW_H
+#define HNSW_SHARDED_HNSW_H
+
+#include "hnsw.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <queue>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// ------------------------- Sharded HNSW -------------------------
+// S independent HNSW instances behind one interface. Every label belongs to one shard, by hash
+// or by label range, so shards never share a lock: a parallel build scales with the shard count
+// instead of contending on one global_lock_, and each shard's memory is bounded by its share.
+// A query runs on all shards concurrently and their (distance, label) lists are merged with a
+// k-way heap.
+class ShardedHNSW {
+public:
+    enum class Partition { HASH, RANGE };
+
+    struct Params {
+        int shards = 4;
+        int M = 16;
+        int ef_construction = 200;
+        Partition partition = Partition::HASH;
+        size_t capacity = 0;// RANGE: labels [0, capacity) are split into equal ranges
+        int search_threads = 0;// search(): shards searched in parallel, 0 = one thread per shard
+    };
+
+    ShardedHNSW(int dim, const Params &sp) : dim_(dim), sp_(sp) {
+        if (sp.shards < 1) throw std::invalid_argument("ShardedHNSW: shards must be >= 1");
+        if (sp.partition == Partition::RANGE && sp.capacity == 0)
+            throw std::invalid_argument("ShardedHNSW: range partitioning needs a capacity");
+        for (int s = 0; s < sp.shards; s++) shards_.push_back(std::make_unique<HNSW>(dim, sp.M, sp.ef_construction));
+    }
+
+    int shard_of(int label) const {
+        if (sp_.partition == Partition::RANGE)
+            return (int) std::min<size_t>(sp_.shards - 1, (size_t) label * sp_.shards / sp_.capacity);
+        uint64_t h = uint64_t(uint32_t(label)) * 0x9E3779B97F4A7C15ull;// Fibonacci hashing
+        return (int) ((h >> 32) % sp_.shards);
+    }
+
+    // label < 0: use the insertion order as the label
+    void insert(std::span<const float> vec, int label = -1) {
+        if (label < 0) label = (int) size_.load();
+        shards_[shard_of(label)]->insert(vec, label);
+        ++size_;
+    }
+
+    // Row i gets label size() + i. One pool task per shard inserts that shard's rows in order.
+    template<class GetRow>
+    void insert_batch(size_t n, GetRow &&get_row, int num_threads = 8) {
+        const size_t label0 = size_.load();
+        std::vector<std::vector<int>> rows(shards_.size());
+        for (size_t i = 0; i < n; i++) rows[shard_of((int) (label0 + i))].push_back((int) i);
+
+        auto [tp, width] = pool(num_threads);
+        std::vector<std::vector<float>> bufs(width);
+        tp->parallel_for(0, shards_.size(), [&](size_t s, int slot) {
+            for (int i: rows[s]) shards_[s]->insert(get_row(i, bufs[slot]), (int) (label0 + i));
+        }, width);
+        size_ += n;
+    }
+
+    // (squared L2, label) of the k nearest over all shards, closest first. Shards are searched
+    // on Params::search_threads threads of the pool (inline when that is 1, or when the caller
+    // is already a pool worker); their sorted lists are merged with a heap of one cursor per
+    // shard. The pool runs one parallel_for at a time, so concurrent search() callers that fan
+    // out take turns; servers with their own query threads should set search_threads = 1.
+    std::vector<HNSW::Scored> search_scored(std::span<const float> query, int k, int ef_search = -1) const {
+        std::vector<std::vector<HNSW::Scored>> found(shards_.size());
+        auto search_shard = [&](size_t s, int) { found[s] = shards_[s]->search_scored(query, k, ef_search); };
+        int width = std::min<int>(sp_.search_threads > 0 ? sp_.search_threads : sp_.shards, sp_.shards);
+        if (width == 1) {
+            for (size_t s = 0; s < shards_.size(); s++) search_shard(s, 0);
+        } else {
+            auto [tp, w] = pool(width);
+            tp->parallel_for(0, shards_.size(), search_shard, w);
+        }
+
+        using Cursor = std::tuple<float, size_t, size_t>;// (distance, shard, position)
+        std::priority_queue<Cursor, std::vector<Cursor>, std::greater<Cursor>> heap;
+        for (size_t s = 0; s < found.size(); s++)
+            if (!found[s].empty()) heap.emplace(found[s][0].first, s, 0);
+
+        std::vector<HNSW::Scored> res;
+        while (!heap.empty() && (int) res.size() < k) {
+            auto [d, s, i] = heap.top();
+            heap.pop();
+            res.push_back(found[s][i]);
+            if (i + 1 < found[s].size()) heap.emplace(found[s][i + 1].first, s, i + 1);
+        }
+        return res;
+    }
+
+    std::vector<int> search(std::span<const float> query, int k, int ef_search = -1) const {
+        std::vector<int> res;
+        for (auto &[d, label]: search_scored(query, k, ef_search)) res.push_back(label);
+        return res;
+    }
+
+    // search() for every query, spread over the pool; the shard fan-out then runs inline
+    std::vector<std::vector<int>> search_batch(const std::vector<std::vector<float>> &queries, int k,
+                                               int ef_search = -1, int num_threads = 8) const {
+        std::vector<std::vector<int>> res(queries.size());
+        auto [tp, width] = pool(num_threads);
+        tp->parallel_for(0, queries.size(), [&](size_t q, int) {
+            res[q] = search(queries[q], k, ef_search);
+        }, width);
+        return res;
+    }
+
+    int shards() const { return (int) shards_.size(); }
+    size_t shard_size(int s) const { return shards_[s]->size(); }
+    size_t size() const { return size_.load(); }
+
+    size_t link_count() const {
+        size_t links = 0;
+        for (auto &s: shards_) links += s->link_count();
+        return links;
+    }
+
+private:
+    int dim_;
+    Params sp_;
+    std::vector<std::unique_ptr<HNSW>> shards_;
+    std::atomic<size_t> size_{0};
+
+    mutable std::mutex pool_mutex_;
+    mutable std::shared_ptr<ThreadPool> pool_;
+
+    // (pool, width) for one call: the pool is created once, as wide as the first request or
+    // the hardware, and each call runs on num_threads of it
+    std::pair<std::shared_ptr<ThreadPool>, int> pool(int num_threads) const {
+        std::lock_guard lock(pool_mutex_);
+        num_threads = std::max(1, num_threads);
+        if (!pool_)
+            pool_ = std::make_shared<ThreadPool>(std::max<int>(num_threads, std::thread::hardware_concurrency()));
+        return {pool_, std::min(num_threads, pool_->size())};
+    }
+};
+
+#endif// HNSW_SHARDED_HNSW_H
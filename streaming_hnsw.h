@@ -0,0 +1,204 @@
+#ifndef HNSW_STREAMING_HNSW_H
+#define HNSW_STREAMING_HNSW_H
+
+#include "histogram.h"
+#include "hnsw.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// ------------------------- Streaming ingest -------------------------
+// HNSW with non-blocking inserts: enqueue_insert() copies the vector into a bounded lock-free
+// MPSC ring (Vyukov's per-cell sequence numbers) and returns at once; an indexer thread drains
+// the ring in order and inserts each run of ready cells into the graph on the thread pool.
+// A vector is searchable as soon as enqueue_insert() returns: queries brute-force scan the
+// cells that are not indexed yet and merge them with the graph results. indexed() is the
+// watermark below which every ticket is in the graph; flush() waits for it.
+class StreamingHNSW {
+public:
+    struct Params {
+        int M = 16;
+        int ef_construction = 200;
+        size_t capacity = 4096;// ring cells (rounded up to a power of two); producers wait when full
+        size_t batch_max = 256;// cells per indexer round
+        int threads = 1;       // graph insert workers
+    };
+
+    StreamingHNSW(int dim, const Params &sp)
+        : dim_(dim), sp_(sp), index_(dim, sp.M, sp.ef_construction), cap_(std::bit_ceil(std::max<size_t>(sp.capacity, 2))),
+          cells_(cap_), data_(cap_ * dim), pool_(std::make_shared<ThreadPool>(std::max(1, sp.threads))) {
+        if (sp.batch_max < 1) throw std::invalid_argument("StreamingHNSW: batch_max must be >= 1");
+        for (size_t i = 0; i < cap_; i++) cells_[i].seq.store(i, std::memory_order_relaxed);
+        indexer_ = std::thread([this]() { index_loop(); });
+    }
+
+    ~StreamingHNSW() {
+        stop_.store(true);
+        published_.fetch_add(1);
+        published_.notify_one();
+        indexer_.join();
+    }
+
+    StreamingHNSW(const StreamingHNSW &) = delete;
+    StreamingHNSW &operator=(const StreamingHNSW &) = delete;
+
+    // Thread-safe. Returns the ticket of this insert (its position in the ingest order);
+    // waits only while the ring is full.
+    uint64_t enqueue_insert(int label, std::span<const float> vec) {
+        if (vec.size() != (size_t) dim_) throw std::invalid_argument("StreamingHNSW: vector dimension mismatch");
+        uint64_t pos = tail_.load(std::memory_order_relaxed);
+        Cell *c;
+        while (true) {
+            c = &cells_[pos & (cap_ - 1)];
+            int64_t dif = (int64_t) c->seq.load(std::memory_order_acquire) - (int64_t) pos;
+            if (dif == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                std::this_thread::yield();// full: the indexer has not released this cell yet
+                pos = tail_.load(std::memory_order_relaxed);
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        c->label = label;
+        c->enqueued = std::chrono::steady_clock::now();
+        std::copy(vec.begin(), vec.end(), cell_data(pos));
+        c->seq.store(pos + 1, std::memory_order_release);
+
+        published_.fetch_add(1, std::memory_order_release);
+        published_.notify_one();
+        return pos;
+    }
+
+    // Every ticket below this is in the graph
+    uint64_t indexed() const { return indexed_.load(std::memory_order_acquire); }
+
+    // Tickets handed out so far
+    uint64_t enqueued() const { return tail_.load(std::memory_order_acquire); }
+
+    // Wait until ticket is in the graph
+    void wait_indexed(uint64_t ticket) const {
+        for (uint64_t w = indexed(); w <= ticket; w = indexed()) indexed_.wait(w);
+    }
+
+    // Wait until everything enqueued before the call is in the graph
+    void flush() const {
+        uint64_t t = enqueued();
+        if (t > 0) wait_indexed(t - 1);
+    }
+
+    // (squared L2, label) of the k nearest over the graph and the not yet indexed cells
+    std::vector<HNSW::Scored> search_scored(std::span<const float> query, int k, int ef_search = -1) const {
+        // Scan first: a cell released after this scan was indexed before the graph search below
+        std::vector<HNSW::Scored> res = scan_pending(query);
+        auto found = index_.search_scored(query, k, ef_search);
+        res.insert(res.end(), found.begin(), found.end());
+
+        // A cell indexed during the scan can come back from both sides
+        std::sort(res.begin(), res.end());
+        std::unordered_set<int> seen;
+        std::vector<HNSW::Scored> top;
+        for (auto &s: res) {
+            if ((int) top.size() >= k) break;
+            if (seen.insert(s.second).second) top.push_back(s);
+        }
+        return top;
+    }
+
+    std::vector<int> search(std::span<const float> query, int k, int ef_search = -1) const {
+        std::vector<int> res;
+        for (auto &[d, label]: search_scored(query, k, ef_search)) res.push_back(label);
+        return res;
+    }
+
+    const HNSW &graph() const { return index_; }
+    size_t pending() const { return enqueued() - indexed(); }
+
+    // Enqueue-to-indexed delay of every insert so far. Read it after flush().
+    const LatencyHistogram &index_lag() const { return lag_; }
+
+private:
+    struct Cell {
+        std::atomic<uint64_t> seq;// pos: free for ticket pos; pos + 1: holds ticket pos
+        int label = -1;
+        std::chrono::steady_clock::time_point enqueued;
+    };
+
+    int dim_;
+    Params sp_;
+    HNSW index_;
+    const size_t cap_;
+    std::vector<Cell> cells_;
+    std::vector<float> data_;// cap_ x dim, row per cell
+    std::shared_ptr<ThreadPool> pool_;
+
+    alignas(64) std::atomic<uint64_t> tail_{0};     // next ticket
+    alignas(64) std::atomic<uint64_t> published_{0};// bumped per enqueue, the indexer waits on it
+    alignas(64) mutable std::atomic<uint64_t> indexed_{0};
+    std::atomic<bool> stop_{false};
+    std::thread indexer_;
+    LatencyHistogram lag_;// indexer thread only
+
+    float *cell_data(uint64_t pos) { return data_.data() + (pos & (cap_ - 1)) * dim_; }
+    const float *cell_data(uint64_t pos) const { return data_.data() + (pos & (cap_ - 1)) * dim_; }
+
+    bool ready(uint64_t pos) const {
+        return cells_[pos & (cap_ - 1)].seq.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    // Seqlock-style read of the cells in [indexed, tail): a cell counts only if it still holds
+    // the same ticket after its distance was computed, i.e. it was not released and refilled
+    std::vector<HNSW::Scored> scan_pending(std::span<const float> query) const {
+        std::vector<HNSW::Scored> res;
+        const uint64_t end = enqueued();
+        for (uint64_t pos = indexed(); pos < end; pos++) {
+            if (!ready(pos)) continue;
+            const Cell &c = cells_[pos & (cap_ - 1)];
+            int label = c.label;
+            float d = l2_distance(cell_data(pos), query.data(), (size_t) dim_);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (ready(pos)) res.emplace_back(d, label);
+        }
+        return res;
+    }
+
+    // Single consumer: insert the next run of ready cells, advance the watermark, then release
+    // the cells to the producers
+    void index_loop() {
+        uint64_t head = 0;
+        while (true) {
+            uint64_t seen = published_.load(std::memory_order_acquire);
+            uint64_t end = head;
+            while (end - head < sp_.batch_max && ready(end)) end++;
+            if (end == head) {
+                if (stop_.load()) return;
+                published_.wait(seen);
+                continue;
+            }
+
+            pool_->parallel_for(head, end, [&](size_t pos, int) {
+                index_.insert({cell_data(pos), (size_t) dim_}, cells_[pos & (cap_ - 1)].label);
+            });
+
+            auto now = std::chrono::steady_clock::now();
+            for (uint64_t pos = head; pos < end; pos++) lag_.record(now - cells_[pos & (cap_ - 1)].enqueued);
+
+            indexed_.store(end, std::memory_order_release);
+            indexed_.notify_all();
+            for (uint64_t pos = head; pos < end; pos++)
+                cells_[pos & (cap_ - 1)].seq.store(pos + cap_, std::memory_order_release);
+            head = end;
+        }
+    }
+};
+
+#endif// HNSW_STREAMING_HNSW_H
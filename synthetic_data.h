@@ -0,0 +1,104 @@
+#ifndef HNSW_SYNTHETIC_DATA_H
+#define HNSW_SYNTHETIC_DATA_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// ------------------------- Counter-based RNG -------------------------
+// Philox4x32-10 (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3"). Output is a
+// pure function of (counter, key), so any element of a dataset can be generated
+// independently: results do not depend on how rows are split across threads.
+inline std::array<uint32_t, 4> philox4x32(std::array<uint32_t, 4> ctr, std::array<uint32_t, 2> key) {
+    for (int round = 0; round < 10; round++) {
+        uint64_t p0 = uint64_t(0xD2511F53u) * ctr[0];
+        uint64_t p1 = uint64_t(0xCD9E8D57u) * ctr[2];
+        ctr = {uint32_t(p1 >> 32) ^ ctr[1] ^ key[0], uint32_t(p1),
+               uint32_t(p0 >> 32) ^ ctr[3] ^ key[1], uint32_t(p0)};
+        key[0] += 0x9E3779B9u;
+        key[1] += 0xBB67AE85u;
+    }
+    return ctr;
+}
+
+// ------------------------- Gaussian clusters -------------------------
+// Row r of stream `stream` is centers[r / rows_per_cluster] + Normal(0, sigma), with element j
+// drawn from Philox counter (r, j / 4, stream) under key `seed` (Box-Muller, 4 normals per call).
+struct ClusterSpec {
+    const std::vector<std::vector<float>> *centers;
+    size_t rows_per_cluster;
+    float sigma;
+    uint64_t seed;
+    uint32_t stream;// 0 = base, 1 = queries, ...
+};
+
+// Rows [row0, row0 + rows) into out (row-major, dim = centers[0].size())
+inline void fill_cluster_rows(const ClusterSpec &spec, size_t row0, size_t rows, float *out) {
+    const auto &centers = *spec.centers;
+    const size_t dim = centers[0].size();
+    const std::array<uint32_t, 2> key = {uint32_t(spec.seed), uint32_t(spec.seed >> 32)};
+    constexpr float two_pi = 6.28318530717958647692f;
+    constexpr float inv_2_32 = 1.0f / 4294967296.0f;
+
+    for (size_t r = 0; r < rows; r++) {
+        size_t row = row0 + r;
+        const std::vector<float> &c = centers[std::min(row / spec.rows_per_cluster, centers.size() - 1)];
+        float *dst = out + r * dim;
+
+        for (size_t j = 0; j < dim; j += 4) {
+            auto u = philox4x32({uint32_t(row), uint32_t(j / 4), spec.stream, uint32_t(uint64_t(row) >> 32)}, key);
+            float z[4];
+            for (int h = 0; h < 2; h++) {
+                float u1 = (float(u[2 * h]) + 1.0f) * inv_2_32;// (0, 1]: log stays finite
+                float u2 = float(u[2 * h + 1]) * inv_2_32;
+                float rad = std::sqrt(-2.0f * std::log(u1));
+                z[2 * h] = rad * std::cos(two_pi * u2);
+                z[2 * h + 1] = rad * std::sin(two_pi * u2);
+            }
+            for (size_t e = 0; e < 4 && j + e < dim; e++) dst[j + e] = c[j + e] + spec.sigma * z[e];
+        }
+    }
+}
+
+// Rows [row0, row0 + n) into a contiguous buffer, split across threads.
+// The output does not depend on num_threads.
+inline void generate_clusters(const ClusterSpec &spec, size_t row0, size_t n, float *out, int num_threads) {
+    const size_t dim = spec.centers->at(0).size();
+    num_threads = std::max(1, std::min<int>(num_threads, (int) std::max<size_t>(1, n / 1024)));
+    size_t per = (n + num_threads - 1) / num_threads;
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < num_threads; t++) {
+        size_t r0 = std::min(n, t * per), r1 = std::min(n, r0 + per);
+        workers.emplace_back([&, r0, r1]() { fill_cluster_rows(spec, row0 + r0, r1 - r0, out + r0 * dim); });
+    }
+    for (auto &w: workers) w.join();
+}
+
+// Stream n rows to an .fvecs file, generating CHUNK rows at a time
+inline void write_clusters_fvecs(const std::string &path, const ClusterSpec &spec, size_t n, int num_threads) {
+    constexpr size_t CHUNK = 1 << 16;
+    const size_t dim = spec.centers->at(0).size();
+    std::ofstream f(path, std::ios::binary);
+    if (!f) throw std::runtime_error("Cannot write " + path);
+
+    std::vector<float> rows(std::min(CHUNK, n) * dim);
+    const int32_t d = dim;
+    for (size_t r0 = 0; r0 < n; r0 += CHUNK) {
+        size_t cnt = std::min(CHUNK, n - r0);
+        generate_clusters(spec, r0, cnt, rows.data(), num_threads);
+        for (size_t r = 0; r < cnt; r++) {
+            f.write(reinterpret_cast<const char *>(&d), sizeof(d));
+            f.write(reinterpret_cast<const char *>(&rows[r * dim]), dim * sizeof(float));
+        }
+    }
+    if (!f) throw std::runtime_error("Cannot write " + path);
+}
+
+#endif// HNSW_SYNTHETIC_DATA_H
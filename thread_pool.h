@@ -0,0 +1,219 @@
+#ifndef HNSW_THREAD_POOL_H
+#define HNSW_THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// ------------------------- Work-stealing thread pool -------------------------
+// Persistent workers for parallel_for over an index range, so repeated batch calls do not pay
+// thread startup. Every slot (the calling thread is slot 0) starts with an equal contiguous
+// share of the range and takes chunks off its front under its own lock; a slot that runs dry
+// steals the back half of another slot's range. Chunks shrink as a range drains (remaining / 4,
+// capped at MAX_CHUNK), so load balances at the end without a shared counter bouncing between
+// cores on every item.
+//
+// One parallel_for runs at a time; concurrent callers queue up. A parallel_for issued from a
+// pool worker runs inline on that worker.
+class ThreadPool {
+public:
+    static constexpr size_t MAX_CHUNK = 32;
+
+    // num_threads <= 0: hardware concurrency
+    explicit ThreadPool(int num_threads = 0) {
+        if (num_threads <= 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+        slots_ = std::vector<Slot>(num_threads);
+        for (int t = 1; t < num_threads; t++) workers_.emplace_back([this, t]() { worker_loop(t); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto &w: workers_) w.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    int size() const { return (int) slots_.size(); }
+
+    // fn(i, slot) for every i in [begin, end); slot in [0, size()) identifies the executing
+    // thread, e.g. to index per-thread scratch. The first exception thrown by fn is rethrown.
+    template<class F>
+    void parallel_for(size_t begin, size_t end, F &&fn) {
+        parallel_for(begin, end, std::forward<F>(fn), size());
+    }
+
+    // Same on at most `width` slots (the caller and width - 1 workers, slot < width); the
+    // other workers sit the call out, so one pool serves callers asking for fewer threads
+    template<class F>
+    void parallel_for(size_t begin, size_t end, F &&fn, int width) {
+        if (begin >= end) return;
+        width = std::clamp(width, 1, size());
+        if (width == 1 || tl_pool == this) {
+            int slot = tl_pool == this ? tl_slot : 0;
+            for (size_t i = begin; i < end; i++) fn(i, slot);
+            return;
+        }
+
+        std::lock_guard submit(submit_mutex_);
+        job_ctx_ = &fn;
+        job_run_ = [](void *ctx, size_t lo, size_t hi, int slot) {
+            auto &f = *static_cast<std::remove_reference_t<F> *>(ctx);
+            for (size_t i = lo; i < hi; i++) f(i, slot);
+        };
+        error_ = nullptr;
+
+        size_t n = end - begin, per = n / width, extra = n % width;
+        size_t lo = begin;
+        for (size_t t = 0; t < slots_.size(); t++) {
+            size_t cnt = t < (size_t) width ? per + (t < extra ? 1 : 0) : 0;
+            std::lock_guard slot_lock(slots_[t].m);
+            slots_[t].lo = lo;
+            slots_[t].hi = lo + cnt;
+            lo += cnt;
+        }
+
+        {
+            std::lock_guard lock(mutex_);
+            busy_ = (int) workers_.size();
+            width_ = width;
+            generation_++;
+        }
+        wake_.notify_all();
+
+        {
+            // The caller may itself be a worker of another pool: restore its identity after
+            Identity as_slot0(this, 0);
+            run_slot(0);
+        }
+
+        std::unique_lock lock(mutex_);
+        done_.wait(lock, [&]() { return busy_ == 0; });
+        if (error_) std::rethrow_exception(error_);
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::mutex m;
+        size_t lo = 0, hi = 0;
+    };
+
+    std::vector<Slot> slots_;
+    std::vector<std::thread> workers_;
+
+    std::mutex submit_mutex_;// one parallel_for at a time
+    std::mutex mutex_;       // guards generation_, busy_, width_, stop_, error_
+    std::condition_variable wake_, done_;
+    size_t generation_ = 0;
+    int busy_ = 0;
+    int width_ = 0;          // slots taking part in the current job
+    bool stop_ = false;
+    std::exception_ptr error_;
+
+    void *job_ctx_ = nullptr;
+    void (*job_run_)(void *, size_t, size_t, int) = nullptr;
+
+    static thread_local ThreadPool *tl_pool;
+    static thread_local int tl_slot;
+
+    // Sets this thread's (pool, slot) for a scope and puts the previous one back on exit
+    struct Identity {
+        ThreadPool *pool;
+        int slot;
+        Identity(ThreadPool *p, int s) : pool(tl_pool), slot(tl_slot) {
+            tl_pool = p;
+            tl_slot = s;
+        }
+        ~Identity() {
+            tl_pool = pool;
+            tl_slot = slot;
+        }
+    };
+
+    void worker_loop(int t) {
+        tl_pool = this;
+        tl_slot = t;
+        size_t seen = 0;
+        while (true) {
+            int width;
+            {
+                std::unique_lock lock(mutex_);
+                wake_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+                if (stop_) return;
+                seen = generation_;
+                width = width_;
+            }
+            if (t < width) run_slot(t);
+            {
+                std::lock_guard lock(mutex_);
+                if (--busy_ == 0) done_.notify_one();
+            }
+        }
+    }
+
+    // Drain own range, then steal until every slot is empty
+    void run_slot(int t) {
+        Slot &own = slots_[t];
+        while (true) {
+            size_t lo, hi;
+            {
+                std::lock_guard lock(own.m);
+                size_t left = own.hi - own.lo;
+                if (left == 0) {
+                    lo = hi = 0;
+                } else {
+                    lo = own.lo;
+                    hi = lo + std::clamp<size_t>(left / 4, 1, MAX_CHUNK);
+                    own.lo = hi;
+                }
+            }
+            if (lo == hi) {
+                if (!steal(t)) return;
+                continue;
+            }
+            try {
+                job_run_(job_ctx_, lo, hi, t);
+            } catch (...) {
+                std::lock_guard lock(mutex_);
+                if (!error_) error_ = std::current_exception();
+            }
+        }
+    }
+
+    // Move the back half of the first non-empty victim range into slot t
+    bool steal(int t) {
+        const int n = size();
+        for (int k = 1; k < n; k++) {
+            Slot &victim = slots_[(t + k) % n];
+            size_t lo, hi;
+            {
+                std::lock_guard lock(victim.m);
+                size_t left = victim.hi - victim.lo;
+                if (left == 0) continue;
+                lo = victim.lo + left / 2;// a single item moves whole
+                hi = victim.hi;
+                victim.hi = lo;
+            }
+            std::lock_guard lock(slots_[t].m);
+            slots_[t].lo = lo;
+            slots_[t].hi = hi;
+            return true;
+        }
+        return false;
+    }
+};
+
+inline thread_local ThreadPool *ThreadPool::tl_pool = nullptr;
+inline thread_local int ThreadPool::tl_slot = 0;
+
+#endif// HNSW_THREAD_POOL_H